@@ -0,0 +1,528 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+
+/******* CONSTANTS AND TYPES *******/
+
+#define ADD_STATION "aggiungi-stazione"
+#define DEL_STATION "demolisci-stazione"
+#define ADD_CAR "aggiungi-auto"
+#define DEL_CAR "rottama-auto"
+#define FIND_PATH "pianifica-percorso"
+
+#define MAX_CARS 512
+#define MAX_REPEAT 100
+#define PHASES 6
+#define MIX_SIZE 5
+
+#define UNIFORM 0
+#define EXPONENTIAL 1
+#define BIMODAL 2
+
+typedef long INTEGER;
+
+typedef struct Options Options;
+typedef struct Station Station;
+typedef struct Workload Workload;
+typedef struct Result Result;
+
+struct Options {
+    INTEGER seed, length, density, cars, maxAutonomy, commands, repeat;
+    int autonomy;
+    double mix[MIX_SIZE], forward, threshold;
+    char *binary, *baseline, *save;
+};
+
+struct Station {
+    INTEGER distance, used;
+    INTEGER cars[MAX_CARS];
+};
+
+struct Workload {
+    Station *stations;
+    bool *taken;
+    INTEGER size, used;
+    unsigned long random;
+    FILE *file;
+};
+
+struct Result {
+    char *name;
+    INTEGER commands;
+    double median, fastest, slowest;
+};
+
+
+
+/******* FUNCTION PROTOTYPES *******/
+
+void raiseCustomError (char *message);
+void printUsage ();
+void parseOptions (Options *options, int argc, char **argv);
+unsigned long nextRandom (Workload *workload);
+INTEGER randomBetween (Workload *workload, INTEGER low, INTEGER high);
+double randomUnit (Workload *workload);
+INTEGER randomAutonomy (Workload *workload, Options *options);
+void workloadInit (Workload *workload, Options *options, FILE *file, INTEGER phase);
+void workloadFree (Workload *workload);
+void addStation (Workload *workload, Options *options);
+void writeBuild (Workload *workload, Options *options);
+void writeCommand (Workload *workload, Options *options, int kind);
+void writePhase (Workload *workload, Options *options, INTEGER phase);
+double runBinary (char *binary, char *path);
+int compareDoubles (const void *data1, const void *data2);
+double percentile (double *values, INTEGER count, double fraction);
+void runPhases (Options *options, Result *results);
+void printResults (Result *results, FILE *file);
+bool compareBaseline (Options *options, Result *results);
+
+
+
+/******* PHASES *******/
+
+// the first phase only builds the highway, the others add their commands on top of it
+char *PHASE_NAMES[PHASES] = {"build", "add-car", "scrap-car", "plan-forward", "plan-backward", "mixed"};
+
+
+
+/******* MAIN *******/
+
+int main (int argc, char **argv) {
+    Options options;
+    Workload workload;
+    Result results[PHASES];
+
+    if (argc < 2) {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+    parseOptions(&options, argc, argv);
+
+    if (strcmp(argv[1], "generate") == 0) {
+        workloadInit(&workload, &options, stdout, PHASES - 1);
+        writeBuild(&workload, &options);
+        writePhase(&workload, &options, PHASES - 1);
+        workloadFree(&workload);
+        return EXIT_SUCCESS;
+    }
+    if (strcmp(argv[1], "run") != 0 || options.binary == NULL) {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+
+    runPhases(&options, results);
+    printResults(results, stdout);
+    if (options.save != NULL) {
+        FILE *file = fopen(options.save, "w");
+        if (file == NULL) {
+            raiseCustomError("unable to save baseline");
+        }
+        printResults(results, file);
+        fclose(file);
+    }
+    if (options.baseline != NULL && !compareBaseline(&options, results)) {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+
+
+/******* OPTIONS *******/
+
+void raiseCustomError (char *message) {
+    fprintf(stderr, "[ERROR]: %s\n", message);
+    exit(EXIT_FAILURE);
+}
+
+void printUsage () {
+    fprintf(stderr,
+        "usage: bench generate [options]          write a seeded workload to stdout\n"
+        "       bench run BINARY [options]        time BINARY on seeded workloads\n"
+        "options:\n"
+        "  --seed N             random seed (1)\n"
+        "  --length N           highway length (1000000)\n"
+        "  --density N          stations every 1000 units of highway (20)\n"
+        "  --cars N             average cars per station (10)\n"
+        "  --autonomy KIND      uniform, exponential or bimodal (uniform)\n"
+        "  --max-autonomy N     largest autonomy (5000)\n"
+        "  --commands N         commands per phase (100000)\n"
+        "  --mix A:B:C:D:E      ratios of add-station, demolish, add-car, scrap, plan (1:1:10:10:78)\n"
+        "  --forward F          share of forward trips among plans (0.5)\n"
+        "  --repeat N           runs per phase (5)\n"
+        "  --baseline FILE      compare the medians with a saved run\n"
+        "  --threshold F        slowdown reported as a regression (0.1)\n"
+        "  --save FILE          save this run as a baseline\n");
+}
+
+void parseOptions (Options *options, int argc, char **argv) {
+    double defaultMix[MIX_SIZE] = {1, 1, 10, 10, 78};
+    options->seed = 1;
+    options->length = 1000000;
+    options->density = 20;
+    options->cars = 10;
+    options->autonomy = UNIFORM;
+    options->maxAutonomy = 5000;
+    options->commands = 100000;
+    options->forward = 0.5;
+    options->repeat = 5;
+    options->threshold = 0.1;
+    options->binary = NULL;
+    options->baseline = NULL;
+    options->save = NULL;
+    memcpy(options->mix, defaultMix, sizeof(defaultMix));
+
+    int argIdx = 2;
+    if (argc > 2 && strcmp(argv[1], "run") == 0 && argv[2][0] != '-') {
+        options->binary = argv[2];
+        argIdx = 3;
+    }
+    for (; argIdx < argc; argIdx += 2) {
+        char *name = argv[argIdx];
+        char *value = argIdx + 1 < argc ? argv[argIdx + 1] : NULL;
+        if (value == NULL) {
+            raiseCustomError("missing option value");
+        }
+        if (strcmp(name, "--seed") == 0) {
+            options->seed = atol(value);
+        }
+        else if (strcmp(name, "--length") == 0) {
+            options->length = atol(value);
+        }
+        else if (strcmp(name, "--density") == 0) {
+            options->density = atol(value);
+        }
+        else if (strcmp(name, "--cars") == 0) {
+            options->cars = atol(value);
+        }
+        else if (strcmp(name, "--autonomy") == 0) {
+            if (strcmp(value, "uniform") == 0) {
+                options->autonomy = UNIFORM;
+            }
+            else if (strcmp(value, "exponential") == 0) {
+                options->autonomy = EXPONENTIAL;
+            }
+            else if (strcmp(value, "bimodal") == 0) {
+                options->autonomy = BIMODAL;
+            }
+            else {
+                raiseCustomError("unknown autonomy distribution");
+            }
+        }
+        else if (strcmp(name, "--max-autonomy") == 0) {
+            options->maxAutonomy = atol(value);
+        }
+        else if (strcmp(name, "--commands") == 0) {
+            options->commands = atol(value);
+        }
+        else if (strcmp(name, "--mix") == 0) {
+            if (sscanf(value, "%lf:%lf:%lf:%lf:%lf", options->mix, options->mix + 1, options->mix + 2, options->mix + 3, options->mix + 4) != MIX_SIZE) {
+                raiseCustomError("invalid mix");
+            }
+        }
+        else if (strcmp(name, "--forward") == 0) {
+            options->forward = atof(value);
+        }
+        else if (strcmp(name, "--repeat") == 0) {
+            options->repeat = atol(value);
+        }
+        else if (strcmp(name, "--baseline") == 0) {
+            options->baseline = value;
+        }
+        else if (strcmp(name, "--threshold") == 0) {
+            options->threshold = atof(value);
+        }
+        else if (strcmp(name, "--save") == 0) {
+            options->save = value;
+        }
+        else {
+            raiseCustomError("unknown option");
+        }
+    }
+    if (options->repeat < 1 || options->repeat > MAX_REPEAT) {
+        raiseCustomError("invalid number of runs");
+    }
+    if (options->cars > MAX_CARS || options->length < 1 || options->density < 1 || options->maxAutonomy < 1) {
+        raiseCustomError("invalid highway");
+    }
+}
+
+
+
+/******* WORKLOAD GENERATION *******/
+
+unsigned long nextRandom (Workload *workload) {
+    // xorshift64*, so that the same seed gives the same workload everywhere
+    workload->random ^= workload->random >> 12;
+    workload->random ^= workload->random << 25;
+    workload->random ^= workload->random >> 27;
+    return workload->random * 2685821657736338717ul;
+}
+
+INTEGER randomBetween (Workload *workload, INTEGER low, INTEGER high) {
+    return low + (INTEGER) (nextRandom(workload) % (unsigned long) (high - low + 1));
+}
+
+double randomUnit (Workload *workload) {
+    return (nextRandom(workload) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+INTEGER randomAutonomy (Workload *workload, Options *options) {
+    double unit = randomUnit(workload);
+    INTEGER autonomy;
+    if (options->autonomy == EXPONENTIAL) {
+        // halve the range on every coin flip: most cars barely reach the next station, a few cross long stretches
+        INTEGER limit = options->maxAutonomy;
+        while (limit > 0 && unit < 0.5) {
+            limit /= 2;
+            unit = randomUnit(workload);
+        }
+        autonomy = randomBetween(workload, 0, limit);
+    }
+    else if (options->autonomy == BIMODAL) {
+        autonomy = unit < 0.8 ? randomBetween(workload, 0, options->maxAutonomy / 10) : randomBetween(workload, options->maxAutonomy * 9 / 10, options->maxAutonomy);
+    }
+    else {
+        autonomy = randomBetween(workload, 0, options->maxAutonomy);
+    }
+    return autonomy < options->maxAutonomy ? autonomy : options->maxAutonomy;
+}
+
+void workloadInit (Workload *workload, Options *options, FILE *file, INTEGER phase) {
+    workload->size = options->length / 1000 * options->density + options->commands + 1;
+    workload->stations = malloc(workload->size * sizeof(Station));
+    workload->taken = calloc(options->length + 1, sizeof(bool));
+    workload->used = 0;
+    workload->random = (unsigned long) options->seed * 0x9E3779B97F4A7C15ul + (unsigned long) phase + 1;
+    workload->file = file;
+}
+
+void workloadFree (Workload *workload) {
+    free(workload->stations);
+    free(workload->taken);
+}
+
+void addStation (Workload *workload, Options *options) {
+    Station *station = workload->stations + workload->used;
+    INTEGER distance = randomBetween(workload, 0, options->length);
+    // stations never share a distance, or the planner would reject queries on the copies
+    if (workload->used > options->length) {
+        raiseCustomError("highway too short for the stations");
+    }
+    while (workload->taken[distance]) {
+        distance = distance < options->length ? distance + 1 : 0;
+    }
+    workload->taken[distance] = true;
+    workload->used++;
+    station->distance = distance;
+    station->used = randomBetween(workload, 0, 2 * options->cars);
+    if (station->used > MAX_CARS) {
+        station->used = MAX_CARS;
+    }
+    fprintf(workload->file, "%s %ld %ld", ADD_STATION, distance, station->used);
+    for (INTEGER carIdx = 0; carIdx < station->used; carIdx++) {
+        station->cars[carIdx] = randomAutonomy(workload, options);
+        fprintf(workload->file, " %ld", station->cars[carIdx]);
+    }
+    fprintf(workload->file, "\n");
+}
+
+void writeBuild (Workload *workload, Options *options) {
+    INTEGER count = options->length / 1000 * options->density;
+    // the build always uses the same stream, whatever the phase
+    unsigned long random = workload->random;
+    workload->random = (unsigned long) options->seed * 0x9E3779B97F4A7C15ul;
+    for (INTEGER stationIdx = 0; stationIdx < count; stationIdx++) {
+        addStation(workload, options);
+    }
+    workload->random = random;
+}
+
+void writeCommand (Workload *workload, Options *options, int kind) {
+    Station *station, *other;
+    INTEGER car;
+    if (workload->used == 0 || kind == 0) {
+        addStation(workload, options);
+        return;
+    }
+    station = workload->stations + randomBetween(workload, 0, workload->used - 1);
+    if (kind == 1) {
+        fprintf(workload->file, "%s %ld\n", DEL_STATION, station->distance);
+        workload->taken[station->distance] = false;
+        *station = workload->stations[--workload->used];
+    }
+    else if (kind == 2) {
+        car = randomAutonomy(workload, options);
+        fprintf(workload->file, "%s %ld %ld\n", ADD_CAR, station->distance, car);
+        if (station->used < MAX_CARS) {
+            station->cars[station->used++] = car;
+        }
+    }
+    else if (kind == 3) {
+        if (station->used == 0) {
+            fprintf(workload->file, "%s %ld %ld\n", DEL_CAR, station->distance, randomAutonomy(workload, options));
+            return;
+        }
+        INTEGER carIdx = randomBetween(workload, 0, station->used - 1);
+        fprintf(workload->file, "%s %ld %ld\n", DEL_CAR, station->distance, station->cars[carIdx]);
+        station->cars[carIdx] = station->cars[--station->used];
+    }
+    else {
+        other = workload->stations + randomBetween(workload, 0, workload->used - 1);
+        bool forward = randomUnit(workload) < options->forward;
+        INTEGER low = station->distance < other->distance ? station->distance : other->distance;
+        INTEGER high = station->distance < other->distance ? other->distance : station->distance;
+        fprintf(workload->file, "%s %ld %ld\n", FIND_PATH, forward ? low : high, forward ? high : low);
+    }
+}
+
+void writePhase (Workload *workload, Options *options, INTEGER phase) {
+    double total = 0, unit;
+    int kind;
+    for (int mixIdx = 0; mixIdx < MIX_SIZE; mixIdx++) {
+        total += options->mix[mixIdx];
+    }
+    for (INTEGER commandIdx = 0; phase > 0 && commandIdx < options->commands; commandIdx++) {
+        if (phase == 1) {
+            kind = 2;
+        }
+        else if (phase == 2) {
+            kind = 3;
+        }
+        else if (phase == 3 || phase == 4) {
+            kind = 4;
+        }
+        else {
+            unit = randomUnit(workload) * total;
+            for (kind = 0; kind < MIX_SIZE - 1 && unit >= options->mix[kind]; kind++) {
+                unit -= options->mix[kind];
+            }
+        }
+        if (phase == 3 || phase == 4) {
+            double forward = options->forward;
+            options->forward = phase == 3 ? 1 : 0;
+            writeCommand(workload, options, kind);
+            options->forward = forward;
+        } else {
+            writeCommand(workload, options, kind);
+        }
+    }
+}
+
+
+
+/******* RUNNING *******/
+
+double runBinary (char *binary, char *path) {
+    struct timespec start, end;
+    int status;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if (pid == 0) {
+        int input = open(path, O_RDONLY);
+        int output = open("/dev/null", O_WRONLY);
+        dup2(input, STDIN_FILENO);
+        dup2(output, STDOUT_FILENO);
+        execl(binary, binary, (char*) NULL);
+        _exit(127);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        raiseCustomError("benchmarked binary failed");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+}
+
+int compareDoubles (const void *data1, const void *data2) {
+    double value1 = *(double*) data1;
+    double value2 = *(double*) data2;
+    return value1 < value2 ? -1 : value1 > value2;
+}
+
+double percentile (double *values, INTEGER count, double fraction) {
+    INTEGER idx = (INTEGER) (fraction * (count - 1) + 0.5);
+    return values[idx];
+}
+
+void runPhases (Options *options, Result *results) {
+    char path[] = "/tmp/bench-workload-XXXXXX";
+    double times[MAX_REPEAT], buildTime = 0;
+    Workload workload;
+
+    for (INTEGER phase = 0; phase < PHASES; phase++) {
+        int descriptor = mkstemp(path);
+        if (descriptor < 0) {
+            raiseCustomError("unable to create the workload file");
+        }
+        workloadInit(&workload, options, fdopen(descriptor, "w"), phase);
+        writeBuild(&workload, options);
+        writePhase(&workload, options, phase);
+        fclose(workload.file);
+        workloadFree(&workload);
+
+        // the other phases pay for the build too, which is subtracted
+        for (INTEGER run = 0; run < options->repeat; run++) {
+            times[run] = runBinary(options->binary, path);
+            if (phase > 0) {
+                times[run] = (times[run] - buildTime) / options->commands;
+            } else {
+                times[run] /= options->length / 1000 * options->density;
+            }
+        }
+        unlink(path);
+        strcpy(path, "/tmp/bench-workload-XXXXXX");
+
+        qsort(times, options->repeat, sizeof(double), compareDoubles);
+        results[phase].name = PHASE_NAMES[phase];
+        results[phase].commands = phase > 0 ? options->commands : options->length / 1000 * options->density;
+        // every run only gives its average cost per command, so these are spreads
+        // between runs; the latency of single commands is in the PLANNER_STATS histograms
+        results[phase].median = percentile(times, options->repeat, 0.5);
+        results[phase].fastest = times[0];
+        results[phase].slowest = times[options->repeat - 1];
+        if (phase == 0) {
+            buildTime = results[phase].median * results[phase].commands;
+        }
+    }
+}
+
+void printResults (Result *results, FILE *file) {
+    fprintf(file, "# phase commands median_run_ns fastest_run_ns slowest_run_ns commands_per_s\n");
+    for (INTEGER phase = 0; phase < PHASES; phase++) {
+        fprintf(file, "%s %ld %.1f %.1f %.1f %.0f\n", results[phase].name, results[phase].commands, results[phase].median, results[phase].fastest, results[phase].slowest, results[phase].median > 0 ? 1e9 / results[phase].median : 0);
+    }
+}
+
+bool compareBaseline (Options *options, Result *results) {
+    FILE *file = fopen(options->baseline, "r");
+    char line[256], name[64];
+    INTEGER commands;
+    double median, fastest, slowest, cost;
+    bool passed = true;
+    if (file == NULL) {
+        raiseCustomError("unable to read baseline");
+    }
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] == '#' || sscanf(line, "%63s %ld %lf %lf %lf", name, &commands, &median, &fastest, &slowest) != 5) {
+            continue;
+        }
+        for (INTEGER phase = 0; phase < PHASES; phase++) {
+            if (strcmp(name, results[phase].name) != 0 || median <= 0) {
+                continue;
+            }
+            cost = results[phase].median / median - 1;
+            printf("%s %+.1f%%%s\n", name, 100 * cost, cost > options->threshold ? " REGRESSION" : "");
+            if (cost > options->threshold) {
+                passed = false;
+            }
+        }
+    }
+    fclose(file);
+    return passed;
+}
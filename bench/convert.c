@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/******* CONSTANTS AND TYPES *******/
+
+#define ADD_STATION "aggiungi-stazione"
+#define DEL_STATION "demolisci-stazione"
+#define ADD_CAR "aggiungi-auto"
+#define DEL_CAR "rottama-auto"
+#define FIND_PATH "pianifica-percorso"
+#define COUNT_STOPS "conta-tappe"
+#define SUBSCRIBE "sottoscrivi-percorso"
+#define UNSUBSCRIBE "annulla-percorso"
+
+#define ADD_STATION_COMMAND 1
+#define DEL_STATION_COMMAND 2
+#define ADD_CAR_COMMAND 3
+#define DEL_CAR_COMMAND 4
+#define FIND_PATH_COMMAND 5
+#define COUNT_STOPS_COMMAND 6
+#define HIGHWAY_COMMAND 7
+#define SUBSCRIBE_COMMAND 8
+#define UNSUBSCRIBE_COMMAND 9
+
+#define ADDED "aggiunta"
+#define NOT_ADDED "non aggiunta"
+#define DEMOLISHED "demolita"
+#define NOT_DEMOLISHED "non demolita"
+#define SCRAPPED "rottamata"
+#define NOT_SCRAPPED "non rottamata"
+#define SUBSCRIBED "sottoscritta"
+#define NOT_SUBSCRIBED "non sottoscritta"
+#define UNSUBSCRIBED "annullata"
+#define NOT_UNSUBSCRIBED "non annullata"
+#define NO_PATH "nessun percorso"
+#define UPDATED "aggiornamento"
+
+#define BINARY_INTEGER_SIZE 8
+#define BINARY_DONE 1
+#define BINARY_UPDATED 2
+#define NO_PATH_LENGTH -1
+#define TOKEN_SIZE 64
+
+typedef long INTEGER;
+
+
+
+/******* FUNCTION PROTOTYPES *******/
+
+void raiseCustomError (char *message);
+void printUsage ();
+INTEGER readInt (FILE *file);
+void writeInt (FILE *file, INTEGER value);
+INTEGER readBinaryInt (FILE *file);
+void writeBinaryInt (FILE *file, INTEGER value);
+int commandCode (char *token);
+char* commandName (int command);
+void toBinary (FILE *input, FILE *output);
+void toText (FILE *input, FILE *output);
+void pathToText (FILE *replies, FILE *output, INTEGER length);
+void repliesToText (FILE *commands, FILE *replies, FILE *output);
+
+
+
+/******* MAIN *******/
+
+int main (int argc, char **argv) {
+    if (argc == 2 && strcmp(argv[1], "binary") == 0) {
+        toBinary(stdin, stdout);
+        return EXIT_SUCCESS;
+    }
+    if (argc == 2 && strcmp(argv[1], "text") == 0) {
+        toText(stdin, stdout);
+        return EXIT_SUCCESS;
+    }
+    if (argc == 3 && strcmp(argv[1], "replies") == 0) {
+        FILE *commands = fopen(argv[2], "rb");
+        if (commands == NULL) {
+            raiseCustomError("unable to read the commands");
+        }
+        repliesToText(commands, stdin, stdout);
+        fclose(commands);
+        return EXIT_SUCCESS;
+    }
+    printUsage();
+    return EXIT_FAILURE;
+}
+
+
+
+/******* HELPERS *******/
+
+void raiseCustomError (char *message) {
+    fprintf(stderr, "[ERROR]: %s\n", message);
+    exit(EXIT_FAILURE);
+}
+
+void printUsage () {
+    fprintf(stderr,
+        "usage: convert binary < commands.txt > commands.bin\n"
+        "       convert text < commands.bin > commands.txt\n"
+        "       convert replies commands.bin < replies.bin > replies.txt\n");
+}
+
+INTEGER readInt (FILE *file) {
+    INTEGER value;
+    if (fscanf(file, "%ld", &value) != 1) {
+        raiseCustomError("unable to read integer");
+    }
+    return value;
+}
+
+void writeInt (FILE *file, INTEGER value) {
+    fprintf(file, " %ld", value);
+}
+
+// binary integers are BINARY_INTEGER_SIZE little endian bytes, whatever the host
+
+INTEGER readBinaryInt (FILE *file) {
+    unsigned char bytes[BINARY_INTEGER_SIZE];
+    unsigned long value = 0;
+    if (fread(bytes, 1, BINARY_INTEGER_SIZE, file) != BINARY_INTEGER_SIZE) {
+        raiseCustomError("unable to read integer");
+    }
+    for (int byteIdx = BINARY_INTEGER_SIZE - 1; byteIdx >= 0; byteIdx--) {
+        value = value << 8 | bytes[byteIdx];
+    }
+    return (INTEGER) value;
+}
+
+void writeBinaryInt (FILE *file, INTEGER value) {
+    unsigned char bytes[BINARY_INTEGER_SIZE];
+    unsigned long bits = (unsigned long) value;
+    for (int byteIdx = 0; byteIdx < BINARY_INTEGER_SIZE; byteIdx++) {
+        bytes[byteIdx] = bits & 0xFF;
+        bits >>= 8;
+    }
+    fwrite(bytes, 1, BINARY_INTEGER_SIZE, file);
+}
+
+// the highway code has no name, it is written as a number before the command
+
+int commandCode (char *token) {
+    char *names[] = {ADD_STATION, DEL_STATION, ADD_CAR, DEL_CAR, FIND_PATH, COUNT_STOPS, NULL, SUBSCRIBE, UNSUBSCRIBE};
+    for (int command = ADD_STATION_COMMAND; command <= UNSUBSCRIBE_COMMAND; command++) {
+        if (names[command - 1] != NULL && strcmp(token, names[command - 1]) == 0) {
+            return command;
+        }
+    }
+    raiseCustomError("unknown command");
+    return 0;
+}
+
+char* commandName (int command) {
+    char *names[] = {ADD_STATION, DEL_STATION, ADD_CAR, DEL_CAR, FIND_PATH, COUNT_STOPS, NULL, SUBSCRIBE, UNSUBSCRIBE};
+    if (command < ADD_STATION_COMMAND || command > UNSUBSCRIBE_COMMAND || names[command - 1] == NULL) {
+        raiseCustomError("unknown command");
+    }
+    return names[command - 1];
+}
+
+
+
+/******* CONVERSIONS *******/
+
+void toBinary (FILE *input, FILE *output) {
+    char token[TOKEN_SIZE];
+    INTEGER counter;
+    int command;
+    // every command keeps its integers in the text order, only their encoding changes
+    while (fscanf(input, "%63s", token) == 1) {
+        // a highway is its own code and integer, followed by the command it names
+        if (token[0] >= '0' && token[0] <= '9') {
+            fputc(HIGHWAY_COMMAND, output);
+            writeBinaryInt(output, strtol(token, NULL, 10));
+            continue;
+        }
+        command = commandCode(token);
+        fputc(command, output);
+        writeBinaryInt(output, readInt(input));
+        if (command == ADD_STATION_COMMAND) {
+            counter = readInt(input);
+            writeBinaryInt(output, counter);
+            for (INTEGER carIdx = 0; carIdx < counter; carIdx++) {
+                writeBinaryInt(output, readInt(input));
+            }
+        }
+        else if (command != DEL_STATION_COMMAND) {
+            writeBinaryInt(output, readInt(input));
+        }
+    }
+}
+
+void toText (FILE *input, FILE *output) {
+    INTEGER counter;
+    int command;
+    while ((command = fgetc(input)) != EOF) {
+        if (command == HIGHWAY_COMMAND) {
+            fprintf(output, "%ld ", readBinaryInt(input));
+            continue;
+        }
+        fputs(commandName(command), output);
+        writeInt(output, readBinaryInt(input));
+        if (command == ADD_STATION_COMMAND) {
+            counter = readBinaryInt(input);
+            writeInt(output, counter);
+            for (INTEGER carIdx = 0; carIdx < counter; carIdx++) {
+                writeInt(output, readBinaryInt(input));
+            }
+        }
+        else if (command != DEL_STATION_COMMAND) {
+            writeInt(output, readBinaryInt(input));
+        }
+        fputc('\n', output);
+    }
+}
+
+void pathToText (FILE *replies, FILE *output, INTEGER length) {
+    if (length == NO_PATH_LENGTH) {
+        fprintf(output, "%s\n", NO_PATH);
+        return;
+    }
+    for (INTEGER stationIdx = 0; stationIdx < length; stationIdx++) {
+        fprintf(output, stationIdx > 0 ? " %ld" : "%ld", readBinaryInt(replies));
+    }
+    fputc('\n', output);
+}
+
+void repliesToText (FILE *commands, FILE *replies, FILE *output) {
+    char *done[] = {ADDED, DEMOLISHED, ADDED, SCRAPPED, NULL, NULL, NULL, SUBSCRIBED, UNSUBSCRIBED};
+    char *failed[] = {NOT_ADDED, NOT_DEMOLISHED, NOT_ADDED, NOT_SCRAPPED, NULL, NULL, NULL, NOT_SUBSCRIBED, NOT_UNSUBSCRIBED};
+    INTEGER counter, length, updates, start, end;
+    int command, status;
+    // the replies carry no command code, so the commands tell how to read each one
+    while ((command = fgetc(commands)) != EOF) {
+        if (command == HIGHWAY_COMMAND) {
+            readBinaryInt(commands);
+            continue;
+        }
+        commandName(command);
+        readBinaryInt(commands);
+        if (command == ADD_STATION_COMMAND) {
+            counter = readBinaryInt(commands);
+            for (INTEGER carIdx = 0; carIdx < counter; carIdx++) {
+                readBinaryInt(commands);
+            }
+        }
+        else if (command != DEL_STATION_COMMAND) {
+            readBinaryInt(commands);
+        }
+
+        if (command == FIND_PATH_COMMAND || command == COUNT_STOPS_COMMAND) {
+            length = readBinaryInt(replies);
+            if (command == COUNT_STOPS_COMMAND && length != NO_PATH_LENGTH) {
+                fprintf(output, "%ld\n", length);
+                continue;
+            }
+            pathToText(replies, output, length);
+        }
+        else {
+            if ((status = fgetc(replies)) == EOF) {
+                raiseCustomError("missing reply");
+            }
+            fprintf(output, "%s\n", status & BINARY_DONE ? done[command - 1] : failed[command - 1]);
+            // the subscribed routes changed by the command follow its status
+            updates = status & BINARY_UPDATED ? readBinaryInt(replies) : 0;
+            for (INTEGER updateIdx = 0; updateIdx < updates; updateIdx++) {
+                start = readBinaryInt(replies);
+                end = readBinaryInt(replies);
+                fprintf(output, "%s %ld %ld: ", UPDATED, start, end);
+                pathToText(replies, output, readBinaryInt(replies));
+            }
+        }
+    }
+}
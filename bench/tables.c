@@ -0,0 +1,376 @@
+#define PLANNER_LIBRARY
+#include "../main.c"
+
+
+/******* CONSTANTS AND TYPES *******/
+
+// the chained tables the planner had before, kept here to compare against
+#define CHAINED_MAX_SIZE 512
+#define CHAINED_LOAD_FACTOR 1
+
+#define TABLES_OPERATIONS 4
+#define TABLES_TOTAL_KEYS 1000000
+#define TABLES_KEY_MULTIPLIER 2654435761l
+#define TABLES_KEY_MIXER 1540483477l
+#define TABLES_KEY_MASK 0x7FFFFFFFl
+#define TABLES_MAX_SIZES 16
+#define TABLES_MAX_REPEAT 100
+
+typedef struct ChainedNode ChainedNode;
+typedef struct Chained Chained;
+typedef struct TableOptions TableOptions;
+
+// car sets and the station table shared this layout, except for the station payload
+struct ChainedNode {
+    INTEGER key, count;
+    ChainedNode *next;
+};
+
+struct Chained {
+    ChainedNode **data;
+    Pool *nodes;
+    INTEGER size, used, maxSize;
+};
+
+struct TableOptions {
+    INTEGER sizes[TABLES_MAX_SIZES];
+    INTEGER sizesUsed, repeat;
+};
+
+
+
+/******* FUNCTION PROTOTYPES *******/
+
+void printTablesUsage ();
+void parseTableOptions (TableOptions *options, int argc, char **argv);
+Chained* chainedInit (INTEGER size, INTEGER maxSize);
+void chainedFree (Chained *chained);
+void chainedResize (Chained *chained);
+ChainedNode* chainedSearch (Chained *chained, INTEGER key, ChainedNode **prev);
+bool chainedInsert (Chained *chained, INTEGER key);
+bool chainedDelete (Chained *chained, INTEGER key);
+INTEGER tableKey (INTEGER idx);
+double clockNs ();
+void timeSets (INTEGER keys, double *times);
+void timeTables (INTEGER keys, double *times);
+void timeChained (INTEGER keys, INTEGER maxSize, double *times);
+int compareTimes (const void *data1, const void *data2);
+void runTables (char *name, INTEGER keys, INTEGER repeat, bool capped);
+
+
+
+/******* MAIN *******/
+
+char *OPERATION_NAMES[TABLES_OPERATIONS] = {"insert", "lookup-hit", "lookup-miss", "delete"};
+
+int main (int argc, char **argv) {
+    TableOptions options;
+    parseTableOptions(&options, argc, argv);
+    printf("# table operation keys open_ns chained_ns speedup\n");
+    for (INTEGER sizeIdx = 0; sizeIdx < options.sizesUsed; sizeIdx++) {
+        runTables("set", options.sizes[sizeIdx], options.repeat, true);
+    }
+    for (INTEGER sizeIdx = 0; sizeIdx < options.sizesUsed; sizeIdx++) {
+        runTables("stations", options.sizes[sizeIdx], options.repeat, false);
+    }
+    return EXIT_SUCCESS;
+}
+
+
+
+/******* OPTIONS *******/
+
+void printTablesUsage () {
+    fprintf(stderr,
+        "usage: tables [options]     time Set and HashTable against the chained tables\n"
+        "options:\n"
+        "  --keys N         keys per table, may be repeated (16, 512, 5000, 100000)\n"
+        "  --repeat N       runs per measure (5)\n");
+}
+
+void parseTableOptions (TableOptions *options, int argc, char **argv) {
+    INTEGER defaults[] = {16, 512, 5000, 100000};
+    options->sizesUsed = 0;
+    options->repeat = 5;
+    for (int argIdx = 1; argIdx < argc; argIdx++) {
+        if (strcmp(argv[argIdx], "--keys") == 0 && argIdx + 1 < argc && options->sizesUsed < TABLES_MAX_SIZES) {
+            options->sizes[options->sizesUsed++] = atol(argv[++argIdx]);
+        }
+        else if (strcmp(argv[argIdx], "--repeat") == 0 && argIdx + 1 < argc) {
+            options->repeat = atol(argv[++argIdx]);
+        }
+        else {
+            printTablesUsage();
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (options->sizesUsed == 0) {
+        memcpy(options->sizes, defaults, sizeof(defaults));
+        options->sizesUsed = sizeof(defaults) / sizeof(INTEGER);
+    }
+    for (INTEGER sizeIdx = 0; sizeIdx < options->sizesUsed; sizeIdx++) {
+        if (options->sizes[sizeIdx] < 1 || options->sizes[sizeIdx] > TABLES_TOTAL_KEYS) {
+            raiseCustomError("keys out of range");
+        }
+    }
+    if (options->repeat < 1 || options->repeat > TABLES_MAX_REPEAT) {
+        raiseCustomError("repeat out of range");
+    }
+}
+
+
+
+/******* CHAINED TABLES *******/
+
+Chained* chainedInit (INTEGER size, INTEGER maxSize) {
+    Chained *chained = malloc(sizeof(Chained));
+    chained->data = calloc(size, sizeof(ChainedNode*));
+    chained->nodes = poolInit(sizeof(ChainedNode));
+    chained->size = size;
+    chained->used = 0;
+    chained->maxSize = maxSize;
+    return chained;
+}
+
+void chainedFree (Chained *chained) {
+    poolFree(chained->nodes);
+    free(chained->data);
+    free(chained);
+}
+
+void chainedResize (Chained *chained) {
+    INTEGER size = HT_SIZE_MULTIPLIER * chained->size;
+    ChainedNode **data = calloc(size, sizeof(ChainedNode*));
+    ChainedNode *node, *next;
+    for (INTEGER bucketIdx = 0; bucketIdx < chained->size; bucketIdx++) {
+        for (node = chained->data[bucketIdx]; node != NULL; node = next) {
+            next = node->next;
+            node->next = data[node->key % size];
+            data[node->key % size] = node;
+        }
+    }
+    free(chained->data);
+    chained->data = data;
+    chained->size = size;
+}
+
+ChainedNode* chainedSearch (Chained *chained, INTEGER key, ChainedNode **prev) {
+    ChainedNode *node = chained->data[key % chained->size];
+    *prev = NULL;
+    while (node != NULL && node->key != key) {
+        *prev = node;
+        node = node->next;
+    }
+    return node;
+}
+
+bool chainedInsert (Chained *chained, INTEGER key) {
+    ChainedNode *prev, *node = chainedSearch(chained, key, &prev);
+    if (node != NULL) {
+        node->count++;
+        return false;
+    }
+    // car sets stopped growing at CHAINED_MAX_SIZE buckets, and their chains got longer
+    if ((chained->maxSize == 0 || chained->size < chained->maxSize) && chained->used >= CHAINED_LOAD_FACTOR * chained->size) {
+        chainedResize(chained);
+    }
+    node = poolAlloc(chained->nodes);
+    node->key = key;
+    node->count = 1;
+    node->next = chained->data[key % chained->size];
+    chained->data[key % chained->size] = node;
+    chained->used++;
+    return true;
+}
+
+bool chainedDelete (Chained *chained, INTEGER key) {
+    ChainedNode *prev, *node = chainedSearch(chained, key, &prev);
+    if (node == NULL) {
+        return false;
+    }
+    if (prev == NULL) {
+        chained->data[key % chained->size] = node->next;
+    } else {
+        prev->next = node->next;
+    }
+    poolRelease(chained->nodes, node);
+    chained->used--;
+    return true;
+}
+
+
+
+/******* TIMING *******/
+
+// every step is a bijection on 31 bits, so distinct indices give distinct keys;
+// the first indices are inserted and the next ones missed
+INTEGER tableKey (INTEGER idx) {
+    INTEGER key = idx * TABLES_KEY_MULTIPLIER & TABLES_KEY_MASK;
+    key ^= key >> 15;
+    key = key * TABLES_KEY_MIXER & TABLES_KEY_MASK;
+    return key ^ key >> 13;
+}
+
+double clockNs () {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+// every measure fills enough tables of the given size to reach TABLES_TOTAL_KEYS keys,
+// and times each operation over all of them
+
+void timeSets (INTEGER keys, double *times) {
+    INTEGER count = (TABLES_TOTAL_KEYS + keys - 1) / keys, found = 0;
+    Set **sets = malloc(count * sizeof(Set*));
+    double begin = clockNs();
+    for (INTEGER tableIdx = 0; tableIdx < count; tableIdx++) {
+        sets[tableIdx] = setInit(HT_INITIAL_SIZE);
+        for (INTEGER keyIdx = 0; keyIdx < keys; keyIdx++) {
+            setInsert(sets[tableIdx], tableKey(keyIdx));
+        }
+    }
+    times[0] = clockNs() - begin;
+    begin = clockNs();
+    for (INTEGER tableIdx = 0; tableIdx < count; tableIdx++) {
+        for (INTEGER keyIdx = 0; keyIdx < keys; keyIdx++) {
+            found += setSearch(sets[tableIdx], tableKey(keyIdx)) != NULL;
+        }
+    }
+    times[1] = clockNs() - begin;
+    begin = clockNs();
+    for (INTEGER tableIdx = 0; tableIdx < count; tableIdx++) {
+        for (INTEGER keyIdx = 0; keyIdx < keys; keyIdx++) {
+            found += setSearch(sets[tableIdx], tableKey(keys + keyIdx)) != NULL;
+        }
+    }
+    times[2] = clockNs() - begin;
+    begin = clockNs();
+    for (INTEGER tableIdx = 0; tableIdx < count; tableIdx++) {
+        for (INTEGER keyIdx = 0; keyIdx < keys; keyIdx++) {
+            setDelete(sets[tableIdx], tableKey(keyIdx));
+        }
+    }
+    times[3] = clockNs() - begin;
+    for (INTEGER tableIdx = 0; tableIdx < count; tableIdx++) {
+        setFree(sets[tableIdx]);
+    }
+    free(sets);
+    if (found != count * keys) {
+        raiseCustomError("set lookups went wrong");
+    }
+}
+
+void timeTables (INTEGER keys, double *times) {
+    INTEGER count = (TABLES_TOTAL_KEYS + keys - 1) / keys, found = 0;
+    HashTable **tables = malloc(count * sizeof(HashTable*));
+    double begin = clockNs();
+    for (INTEGER tableIdx = 0; tableIdx < count; tableIdx++) {
+        tables[tableIdx] = htInit(HT_INITIAL_SIZE);
+        for (INTEGER keyIdx = 0; keyIdx < keys; keyIdx++) {
+            htInsert(tables[tableIdx], tableKey(keyIdx));
+        }
+    }
+    times[0] = clockNs() - begin;
+    begin = clockNs();
+    for (INTEGER tableIdx = 0; tableIdx < count; tableIdx++) {
+        for (INTEGER keyIdx = 0; keyIdx < keys; keyIdx++) {
+            found += htSearch(tables[tableIdx], tableKey(keyIdx)) != NULL;
+        }
+    }
+    times[1] = clockNs() - begin;
+    begin = clockNs();
+    for (INTEGER tableIdx = 0; tableIdx < count; tableIdx++) {
+        for (INTEGER keyIdx = 0; keyIdx < keys; keyIdx++) {
+            found += htSearch(tables[tableIdx], tableKey(keys + keyIdx)) != NULL;
+        }
+    }
+    times[2] = clockNs() - begin;
+    begin = clockNs();
+    for (INTEGER tableIdx = 0; tableIdx < count; tableIdx++) {
+        for (INTEGER keyIdx = 0; keyIdx < keys; keyIdx++) {
+            htDelete(tables[tableIdx], tableKey(keyIdx));
+        }
+    }
+    times[3] = clockNs() - begin;
+    for (INTEGER tableIdx = 0; tableIdx < count; tableIdx++) {
+        htFree(tables[tableIdx]);
+    }
+    free(tables);
+    if (found != count * keys) {
+        raiseCustomError("table lookups went wrong");
+    }
+}
+
+void timeChained (INTEGER keys, INTEGER maxSize, double *times) {
+    INTEGER count = (TABLES_TOTAL_KEYS + keys - 1) / keys, found = 0;
+    Chained **tables = malloc(count * sizeof(Chained*));
+    ChainedNode *prev;
+    double begin = clockNs();
+    for (INTEGER tableIdx = 0; tableIdx < count; tableIdx++) {
+        tables[tableIdx] = chainedInit(HT_INITIAL_SIZE, maxSize);
+        for (INTEGER keyIdx = 0; keyIdx < keys; keyIdx++) {
+            chainedInsert(tables[tableIdx], tableKey(keyIdx));
+        }
+    }
+    times[0] = clockNs() - begin;
+    begin = clockNs();
+    for (INTEGER tableIdx = 0; tableIdx < count; tableIdx++) {
+        for (INTEGER keyIdx = 0; keyIdx < keys; keyIdx++) {
+            found += chainedSearch(tables[tableIdx], tableKey(keyIdx), &prev) != NULL;
+        }
+    }
+    times[1] = clockNs() - begin;
+    begin = clockNs();
+    for (INTEGER tableIdx = 0; tableIdx < count; tableIdx++) {
+        for (INTEGER keyIdx = 0; keyIdx < keys; keyIdx++) {
+            found += chainedSearch(tables[tableIdx], tableKey(keys + keyIdx), &prev) != NULL;
+        }
+    }
+    times[2] = clockNs() - begin;
+    begin = clockNs();
+    for (INTEGER tableIdx = 0; tableIdx < count; tableIdx++) {
+        for (INTEGER keyIdx = 0; keyIdx < keys; keyIdx++) {
+            chainedDelete(tables[tableIdx], tableKey(keyIdx));
+        }
+    }
+    times[3] = clockNs() - begin;
+    for (INTEGER tableIdx = 0; tableIdx < count; tableIdx++) {
+        chainedFree(tables[tableIdx]);
+    }
+    free(tables);
+    if (found != count * keys) {
+        raiseCustomError("chained lookups went wrong");
+    }
+}
+
+int compareTimes (const void *data1, const void *data2) {
+    double value1 = *(double*) data1;
+    double value2 = *(double*) data2;
+    return value1 < value2 ? -1 : value1 > value2;
+}
+
+void runTables (char *name, INTEGER keys, INTEGER repeat, bool capped) {
+    double open[TABLES_OPERATIONS][TABLES_MAX_REPEAT], chained[TABLES_OPERATIONS][TABLES_MAX_REPEAT];
+    double times[TABLES_OPERATIONS], operations = (double) ((TABLES_TOTAL_KEYS + keys - 1) / keys * keys);
+    for (INTEGER run = 0; run < repeat; run++) {
+        if (capped) {
+            timeSets(keys, times);
+        } else {
+            timeTables(keys, times);
+        }
+        for (INTEGER operation = 0; operation < TABLES_OPERATIONS; operation++) {
+            open[operation][run] = times[operation] / operations;
+        }
+        timeChained(keys, capped ? CHAINED_MAX_SIZE : 0, times);
+        for (INTEGER operation = 0; operation < TABLES_OPERATIONS; operation++) {
+            chained[operation][run] = times[operation] / operations;
+        }
+    }
+    // the medians of the runs are reported, per operation
+    for (INTEGER operation = 0; operation < TABLES_OPERATIONS; operation++) {
+        qsort(open[operation], repeat, sizeof(double), compareTimes);
+        qsort(chained[operation], repeat, sizeof(double), compareTimes);
+        printf("%s %s %ld %.1f %.1f %.2f\n", name, OPERATION_NAMES[operation], keys, open[operation][repeat / 2], chained[operation][repeat / 2], chained[operation][repeat / 2] / open[operation][repeat / 2]);
+    }
+}
@@ -1,19 +1,54 @@
+#include <limits.h>
+#include <pthread.h>
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#include <immintrin.h>
+#endif
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "planner.h"
 
 
 /******* CONSTANTS AND TYPES *******/
 
-#define COMMAND_SIZE 20
+// stations and cars are stored with this many bits, 32 or 64; every other
+// quantity, and the values passed to the planner, stay INTEGER
+#ifndef PLANNER_KEY_BITS
+#define PLANNER_KEY_BITS 64
+#endif
+
 #define UNDEFINED 0
+// the empty slots of car sets, which no car can match since isKey refuses negative ones
+#define EMPTY_KEY -1
 
 #define ADD_STATION "aggiungi-stazione"
 #define DEL_STATION "demolisci-stazione"
 #define ADD_CAR "aggiungi-auto"
 #define DEL_CAR "rottama-auto"
 #define FIND_PATH "pianifica-percorso"
+#define COUNT_STOPS "conta-tappe"
+#define SUBSCRIBE "sottoscrivi-percorso"
+#define UNSUBSCRIBE "annulla-percorso"
+
+#define UNKNOWN_COMMAND 0
+#define ADD_STATION_COMMAND 1
+#define DEL_STATION_COMMAND 2
+#define ADD_CAR_COMMAND 3
+#define DEL_CAR_COMMAND 4
+#define FIND_PATH_COMMAND 5
+#define COUNT_STOPS_COMMAND 6
+#define HIGHWAY_COMMAND 7
+#define SUBSCRIBE_COMMAND 8
+#define UNSUBSCRIBE_COMMAND 9
 
 #define ADDED "aggiunta\n"
 #define NOT_ADDED "non aggiunta\n"
@@ -21,793 +56,4144 @@
 #define NOT_DEMOLISHED "non demolita\n"
 #define SCRAPPED "rottamata\n"
 #define NOT_SCRAPPED "non rottamata\n"
+#define SUBSCRIBED "sottoscritta\n"
+#define NOT_SUBSCRIBED "non sottoscritta\n"
+#define UNSUBSCRIBED "annullata\n"
+#define NOT_UNSUBSCRIBED "non annullata\n"
 #define NO_PATH "nessun percorso\n"
+#define UPDATED "aggiornamento "
+
+#define INPUT_BUFFER_SIZE 65536
+#define OUTPUT_BUFFER_SIZE 65536
+#define OUTPUT_BLOCKS 4
+#define OUTPUT_SIZE_MULTIPLIER 2
+#define INTEGER_DIGITS 20
+
+#define BINARY_VARIABLE "PLANNER_BINARY"
+#define BINARY_INTEGER_SIZE 8
+#define BINARY_DONE 1
+#define BINARY_FAILED 0
+#define BINARY_UPDATED 2
+#define BINARY_REFUSED -1
+
+#define PIPELINE_VARIABLE "PLANNER_PIPELINE"
+#define RING_SIZE 65536
+#define RING_CHUNK 1024
 
 #define VECTOR_INITIAL_SIZE 8
 #define VECTOR_SIZE_MULTIPLIER 2
+#define VECTOR_SHRINK_FACTOR 0.25
 
 #define HT_INITIAL_SIZE 4
 #define HT_SIZE_MULTIPLIER 2
-#define HT_LOAD_FACTOR 1
-#define HT_MAX_SIZE 512
+#define HT_LOAD_FACTOR 0.75
+#define HT_SHRINK_FACTOR 0.25
+#define HT_HASH_MULTIPLIER 11400714819323198485ul
+
+#define POOL_INITIAL_SIZE 4
+#define POOL_SIZE_MULTIPLIER 2
+#define POOL_MAX_SIZE 1024
+
+#define HEAP_INITIAL_SIZE 4
+#define HEAP_SIZE_MULTIPLIER 2
+#define HEAP_STALE_FACTOR 2
+
+#define DEFAULT_HIGHWAY 0
+#define HIGHWAY_CHUNK 16384
+#define HIGHWAY_INITIAL_SIZE 4
+
+#define BATCH_SIZE 1024
+#define WORKERS_VARIABLE "PLANNER_THREADS"
+#define WORKERS_MAX 64
+
+#define CACHE_SIZE 1024
+#define CACHE_LOG_SIZE 64
+
+#define TREE_SCAN_LIMIT 16
+
+// the scans widen 32 bit keys to the 64 bit lanes they compare
+#if PLANNER_KEY_BITS == 32
+#define SCAN_LOAD_FOUR(data) _mm256_cvtepi32_epi64(_mm_loadu_si128((__m128i*) (data)))
+#define SCAN_LOAD_TWO(data) _mm_cvtepi32_epi64(_mm_loadl_epi64((__m128i*) (data)))
+#else
+#define SCAN_LOAD_FOUR(data) _mm256_loadu_si256((__m256i*) (data))
+#define SCAN_LOAD_TWO(data) _mm_loadu_si128((__m128i*) (data))
+#endif
+#define TREE_EMPTY_HIGH -1
+#define TREE_EMPTY_LOW LONG_MAX
+
+#define SUBSCRIPTIONS_INITIAL_SIZE 4
+#define SUBSCRIPTION_UNPLANNED -2
+
+#define SNAPSHOT_LOAD_VARIABLE "PLANNER_LOAD"
+#define SNAPSHOT_SAVE_VARIABLE "PLANNER_SAVE"
+#define SNAPSHOT_MAGIC "PLANSNP"
+#define SNAPSHOT_HEADER_SIZE 8
+
+#define STATS_VARIABLE "PLANNER_STATS"
+#define STATS_SUB_BITS 4
+#define STATS_BUCKETS 1024
 
-typedef long INTEGER;
+#define MEMORY_VARIABLE "PLANNER_MEMORY"
 
+typedef planner_int_t INTEGER;
+
+#if PLANNER_KEY_BITS == 32
+typedef int32_t KEY;
+#else
+typedef planner_int_t KEY;
+#endif
+
+// the batch answers with the stored keys, which the planner widens for its reply
+typedef void (*PathReply) (void *context, KEY *path, INTEGER length);
+
+typedef struct Ring Ring;
+typedef struct Input Input;
+typedef struct Output Output;
+typedef struct PoolChunk PoolChunk;
+typedef struct Pool Pool;
 typedef struct SetNode SetNode;
 typedef struct Set Set;
 typedef struct HTNode HTNode;
 typedef struct HashTable HashTable;
-typedef struct StationCar StationCar;
 typedef struct Vector Vector;
+typedef struct Heap Heap;
+typedef struct CacheEntry CacheEntry;
+typedef struct Cache Cache;
+typedef struct Jump Jump;
+typedef struct Tree Tree;
+typedef struct Query Query;
+typedef struct Worker Worker;
+typedef struct Batch Batch;
+typedef struct Histogram Histogram;
+typedef struct Stats Stats;
+typedef struct PathBuffer PathBuffer;
+typedef struct Subscription Subscription;
+typedef struct Subscriptions Subscriptions;
+typedef struct Shard Shard;
+typedef struct HighwayWorker HighwayWorker;
+typedef struct Highways Highways;
+
+struct Ring {
+    INTEGER *data;
+    INTEGER size;
+    atomic_long head, tail;
+};
+
+struct Input {
+    char *data;
+    INTEGER size, used, position, mark;
+    bool finished, binary;
+    Ring *commands;
+    INTEGER *staged;
+    INTEGER stagedSize, stagedUsed;
+    char *error;
+    pthread_t parser;
+    INTEGER *queued;
+    INTEGER queuedSize, queuedUsed, queuedPosition;
+};
+
+struct Output {
+    char *data;
+    INTEGER size, used;
+    bool binary;
+    char **blocks;
+    INTEGER blockIdx;
+    Ring *filled, *released;
+    pthread_t writer;
+    INTEGER *ends;
+    INTEGER endsSize, endsUsed;
+};
+
+struct PoolChunk {
+    PoolChunk *next;
+};
+
+struct Pool {
+    PoolChunk *chunks;
+    void *freeList;
+    INTEGER itemSize, chunkSize, chunkUsed, allocated;
+};
 
 struct SetNode {
-    INTEGER key;
-    SetNode *next;
+    KEY key, count;
 };
 
 struct Set {
-    SetNode **data;
+    SetNode *data;
     INTEGER size, used;
-    SetNode *iterator;
-    bool iterationFinished;
 };
 
+// stations stay chained, so that any key can be stored and a node does not move
+// while the table grows or shrinks
 struct HTNode {
-    INTEGER key;
+    KEY key;
     Set *value;
+    Heap *maxHeap;
     HTNode *next;
 };
 
 struct HashTable {
     HTNode **data;
+    Pool *nodes;
+    INTEGER size, used;
+};
+
+struct Vector {
+    KEY *stations, *cars;
     INTEGER size, used;
-    HTNode *iterator;
-    bool iterationFinished;
 };
 
-struct StationCar {
-    INTEGER station, car;
+struct Heap {
+    KEY *data;
+    INTEGER size, used;
 };
 
-struct Vector {
-    StationCar *data;
+struct CacheEntry {
+    INTEGER start, end, epoch;
+    bool exists, referenced;
+    Vector *path;
+    CacheEntry *next;
+};
+
+struct Cache {
+    CacheEntry *entries;
+    CacheEntry **data;
+    INTEGER size, used, hand;
+    INTEGER epoch;
+    INTEGER *log;
+    bool observed;
+};
+
+struct Jump {
+    KEY *forward, *backward;
+    KEY *forwardReach, *backwardReach;
+    KEY *stack;
+    INTEGER size, used, levels;
+    INTEGER dirtyLow, dirtyHigh;
+    bool reshaped;
+    Vector *layers;
+    INTEGER swept;
+};
+
+struct Tree {
+    INTEGER *high, *low;
+    INTEGER size, used;
+    bool dirty;
+};
+
+struct Query {
+    INTEGER start, end, position;
+    INTEGER worker, offset, length;
+    bool exists, planned;
+};
+
+struct Worker {
+    pthread_t thread;
+    Batch *batch;
+    INTEGER id;
+    Vector *layers, *path, *results;
+};
+
+struct Batch {
+    Query *queries;
+    INTEGER size, used;
+    INTEGER *tasks;
+    INTEGER tasksUsed;
+    atomic_long nextTask;
+    Worker *workers;
+    INTEGER workersUsed;
+    Vector *bestCars;
+    Tree *tree;
+    pthread_barrier_t barrier;
+    bool stopped;
+};
+
+struct Subscription {
+    INTEGER start, end, low, high;
+    KEY *path;
+    INTEGER length, size;
+    bool marked, changed;
+};
+
+struct Subscriptions {
+    Subscription *data;
+    INTEGER size, used;
+    INTEGER *reach;
+    INTEGER leaves;
+    bool dirty;
+    INTEGER *pending;
+    INTEGER pendingUsed, replanned;
+};
+
+struct Planner {
+    HashTable *stations;
+    Vector *bestCars;
+    Cache *cache;
+    Jump *jump;
+    Tree *tree;
+    Batch *batch;
+    Subscriptions *subscriptions;
+    PlannerReply reply;
+    void *context;
+    planner_int_t *wide;
+    INTEGER wideSize;
+};
+
+struct PathBuffer {
+    planner_int_t *data;
+    INTEGER size, length;
+};
+
+struct Shard {
+    INTEGER highway, worker;
+    Planner *planner;
+    Input *input;
+    Output *output;
+    INTEGER merged, offset;
+};
+
+struct HighwayWorker {
+    pthread_t thread;
+    Highways *highways;
+    INTEGER id;
+};
+
+struct Highways {
+    Shard *shards;
+    INTEGER *sorted;
     INTEGER size, used;
+    INTEGER *order;
+    INTEGER orderUsed;
+    HighwayWorker *workers;
+    INTEGER workersUsed;
+    pthread_barrier_t barrier;
+    bool stopped, running;
+    Shard *pushing;
+    INTEGER pushed;
+};
+
+struct Histogram {
+    atomic_long counts[STATS_BUCKETS];
+    atomic_long count, total, max;
 };
 
+struct Stats {
+    char *path;
+    Histogram commands[UNSUBSCRIBE_COMMAND + 1];
+    Histogram batches, scanned, stops, fixups;
+    Histogram htProbes, setProbes;
+    atomic_long htResizes, htShrinks, setResizes, setShrinks;
+    atomic_long cacheHits, cacheMisses;
+};
+
+
+
+#ifndef PLANNER_LIBRARY
+
+/******* RING FUNCTION PROTOTYPES *******/
+
+static Ring* ringInit (INTEGER size);
+static void ringFree (Ring *ring);
+static INTEGER ringLength (Ring *ring);
+static void ringWrite (Ring *ring, INTEGER *values, INTEGER count);
+static INTEGER ringRead (Ring *ring);
+
+
+
+/******* INPUT FUNCTION PROTOTYPES *******/
+
+static Input* inputInit (INTEGER size);
+static Input* inputInitQueue (INTEGER size);
+static void inputFree (Input *input);
+static void inputRefill (Input *input);
+static bool inputHasData (Input *input);
+static bool inputSkipSpaces (Input *input);
+static char* inputReadToken (Input *input, INTEGER *length);
+static INTEGER inputParseInt (Input *input);
+static int inputParseCommand (Input *input);
+static INTEGER inputParseBinaryInt (Input *input);
+static int inputParseBinaryCommand (Input *input);
+static INTEGER inputFail (Input *input, char *message);
+static INTEGER inputReadInt (Input *input);
+static int inputReadCommand (Input *input);
+static void inputStartParser (Input *input);
+static void* inputRunParser (void *data);
+static void inputStage (Input *input, INTEGER value);
+static void inputPublish (Input *input);
+static void inputQueue (Input *input, INTEGER value);
+static void inputClearQueue (Input *input);
+
+
+
+/******* OUTPUT FUNCTION PROTOTYPES *******/
+
+static Output* outputInit (INTEGER size);
+static Output* outputInitReplies (INTEGER size);
+static void outputFree (Output *output);
+static void outputWriteData (char *data, INTEGER length);
+static void outputSwap (Output *output);
+static void outputFlush (Output *output);
+static void outputStartWriter (Output *output);
+static void* outputRunWriter (void *data);
+static void outputWrite (Output *output, char *string, INTEGER length);
+static void outputWriteInt (Output *output, INTEGER value);
+static void outputWriteBinaryInt (Output *output, INTEGER value);
+static void outputEndReply (Output *output);
+static void outputClearReplies (Output *output);
+
+#endif
+
+
+
+/******* POOL FUNCTION PROTOTYPES *******/
+
+static Pool* poolInit (INTEGER itemSize);
+static void poolFree (Pool *pool);
+static void* poolAlloc (Pool *pool);
+static void poolRelease (Pool *pool, void *item);
+
 
 
 /******* SET FUNCTION PROTOTYPES *******/
 
-Set* setInit (INTEGER size);
-INTEGER setBucketIdx (Set *set, INTEGER key);
-SetNode** setBucket (Set *set, INTEGER key);
-void setIter (Set *set);
-SetNode* setNext (Set *set);
-void setFree (Set *set);
-bool setShouldResize (Set *set);
-void setResize (Set *set);
-SetNode* setSearch (Set *set, INTEGER key, SetNode **deleteHelper);
-void setInsert (Set *set, INTEGER key);
-void setInsertNode (Set *set, SetNode *node);
-bool setDelete (Set *set, INTEGER key);
+static Set* setInit (INTEGER size);
+static INTEGER setBucketIdx (Set *set, INTEGER key);
+static INTEGER setProbeDist (Set *set, INTEGER idx);
+static void setIter (INTEGER *iterator);
+static SetNode* setNext (Set *set, INTEGER *iterator);
+static void setFree (Set *set);
+static bool setShouldResize (Set *set);
+static bool setShouldShrink (Set *set);
+static void setResize (Set *set, INTEGER size);
+static SetNode* setSearch (Set *set, INTEGER key);
+static bool setInsert (Set *set, INTEGER key);
+static void setInsertNode (Set *set, SetNode node);
+static bool setDelete (Set *set, INTEGER key);
+static INTEGER setBytes (Set *set);
+static INTEGER setSlack (Set *set);
 
 
 
 /******* HASH TABLE FUNCTION PROTOTYPES *******/
 
-HashTable* htInit (INTEGER size);
-INTEGER htBucketIdx (HashTable *ht, INTEGER key);
-HTNode** htBucket (HashTable *ht, INTEGER key);
-void htIter (HashTable *ht);
-HTNode* htNext (HashTable *ht);
-void htFree (HashTable *ht);
-bool htShouldResize (HashTable *ht);
-void htResize (HashTable *ht);
-HTNode* htSearch (HashTable *ht, INTEGER key, HTNode **deleteHelper);
-void htInsert (HashTable *ht, INTEGER key);
-void htInsertNode (HashTable *ht, HTNode *node);
-bool htDelete (HashTable *ht, INTEGER key);
+static HashTable* htInit (INTEGER size);
+static INTEGER htBucketIdx (HashTable *ht, INTEGER key);
+static HTNode* htNext (HashTable *ht, HTNode *node);
+static void htFree (HashTable *ht);
+static bool htShouldResize (HashTable *ht);
+static bool htShouldShrink (HashTable *ht);
+static void htResize (HashTable *ht, INTEGER size);
+static HTNode* htSearch (HashTable *ht, INTEGER key);
+static void htInsert (HashTable *ht, INTEGER key);
+static void htInsertNode (HashTable *ht, HTNode node);
+static bool htDelete (HashTable *ht, INTEGER key);
+static INTEGER htBytes (HashTable *ht);
+static INTEGER htSlack (HashTable *ht);
 
 
 
 /******* VECTOR FUNCTION PROTOTYPES *******/
 
-Vector* vectorInit (INTEGER size);
-void vectorFree (Vector *v);
-void vectorResize (Vector *v);
-INTEGER vectorLength (Vector *v);
-StationCar* vectorGet (Vector *v, INTEGER idx);
-INTEGER vectorGetStation (Vector *v, INTEGER idx);
-INTEGER vectorGetCar (Vector *v, INTEGER idx);
-void vectorSet (Vector *v, INTEGER idx, INTEGER station, INTEGER car);
-void vectorPush (Vector *v, INTEGER station, INTEGER car);
-INTEGER vectorFindStation (Vector *v, INTEGER station);
-void vectorSortByStation (Vector *v);
-int vectorCompareByStation (const void *data1, const void *data2);
-INTEGER vectorGetStationsDist (Vector *v, INTEGER idx1, INTEGER idx2);
+static Vector* vectorInit (INTEGER size);
+static void vectorFree (Vector *v);
+static void vectorResize (Vector *v);
+static void vectorShrink (Vector *v);
+static INTEGER vectorLength (Vector *v);
+static INTEGER vectorGetStation (Vector *v, INTEGER idx);
+static INTEGER vectorGetCar (Vector *v, INTEGER idx);
+static void vectorSet (Vector *v, INTEGER idx, INTEGER station, INTEGER car);
+static void vectorPush (Vector *v, INTEGER station, INTEGER car);
+static void vectorInsert (Vector *v, INTEGER idx, INTEGER station, INTEGER car);
+static void vectorDelete (Vector *v, INTEGER idx);
+static INTEGER vectorFindStation (Vector *v, INTEGER station);
+static INTEGER vectorLowerBound (Vector *v, INTEGER station);
+static INTEGER vectorLastAtMost (Vector *v, INTEGER fromIdx, INTEGER toIdx, INTEGER station);
+static INTEGER vectorFirstAtLeast (Vector *v, INTEGER fromIdx, INTEGER toIdx, INTEGER station);
+static void vectorCopy (Vector *dest, Vector *src);
+static void vectorTruncate (Vector *v, INTEGER length);
+static INTEGER vectorBytes (Vector *v);
+static INTEGER vectorSlack (Vector *v);
+
+
+
+/******* HEAP FUNCTION PROTOTYPES *******/
+
+static Heap* heapInit (INTEGER size);
+static void heapFree (Heap *heap);
+static void heapResize (Heap *heap);
+static INTEGER heapLength (Heap *heap);
+static INTEGER heapTop (Heap *heap);
+static void heapPush (Heap *heap, INTEGER key);
+static void heapPop (Heap *heap);
+static void heapClear (Heap *heap);
+static INTEGER heapBytes (Heap *heap);
+
+
+
+/******* CACHE FUNCTION PROTOTYPES *******/
+
+static Cache* cacheInit (INTEGER size);
+static void cacheFree (Cache *cache);
+static INTEGER cacheBucketIdx (Cache *cache, INTEGER start, INTEGER end);
+static CacheEntry* cacheSearch (Cache *cache, INTEGER start, INTEGER end);
+static bool cacheIsValid (Cache *cache, CacheEntry *entry);
+static CacheEntry* cacheEvict (Cache *cache);
+static void cacheInsert (Cache *cache, INTEGER start, INTEGER end, bool exists, Vector *path);
+static void cacheInvalidate (Cache *cache, INTEGER station);
+static INTEGER cacheBytes (Cache *cache);
+
+
+
+/******* SCAN FUNCTION PROTOTYPES *******/
+
+static INTEGER scanMaxSum (KEY *stations, KEY *cars, INTEGER firstIdx, INTEGER lastIdx);
+static INTEGER scanMinDifference (KEY *stations, KEY *cars, INTEGER firstIdx, INTEGER lastIdx);
+static INTEGER scanFirstSumAtLeast (KEY *stations, KEY *cars, INTEGER firstIdx, INTEGER lastIdx, INTEGER station);
+static INTEGER scanFirstDifferenceAtMost (KEY *stations, KEY *cars, INTEGER firstIdx, INTEGER lastIdx, INTEGER station);
+
+
+
+/******* JUMP FUNCTION PROTOTYPES *******/
+
+static Jump* jumpInit ();
+static void jumpFree (Jump *jump);
+static void jumpResize (Jump *jump, INTEGER size);
+static bool jumpIsClean (Jump *jump);
+static void jumpMarkCar (Jump *jump, INTEGER idx);
+static void jumpMarkStations (Jump *jump);
+static void jumpUpdate (Jump *jump, Vector *bestCars);
+static void jumpBuildForward (Jump *jump, Vector *bestCars, INTEGER lastIdx);
+static void jumpBuildBackward (Jump *jump, Vector *bestCars, INTEGER firstIdx);
+static INTEGER jumpCountHops (Jump *jump, INTEGER startIdx, INTEGER endIdx);
+static INTEGER jumpBytes (Jump *jump);
+
+
+
+/******* TREE FUNCTION PROTOTYPES *******/
+
+static Tree* treeInit ();
+static void treeFree (Tree *tree);
+static void treeBuild (Tree *tree, Vector *bestCars);
+static void treeUpdate (Tree *tree, INTEGER idx, INTEGER station, INTEGER car);
+static void treeInsert (Tree *tree, INTEGER idx, INTEGER station, INTEGER car);
+static void treeDelete (Tree *tree, INTEGER idx);
+static void treeRefresh (Tree *tree, INTEGER firstIdx, INTEGER lastIdx);
+static INTEGER treeMaxHigh (Tree *tree, INTEGER firstIdx, INTEGER lastIdx);
+static INTEGER treeMinLow (Tree *tree, INTEGER firstIdx, INTEGER lastIdx);
+static INTEGER treeFirstHigh (Tree *tree, INTEGER fromIdx, INTEGER station);
+static INTEGER treeFirstLow (Tree *tree, INTEGER fromIdx, INTEGER station);
+static INTEGER treeBytes (Tree *tree);
+
+
+
+/******* BATCH FUNCTION PROTOTYPES *******/
+
+static Batch* batchInit (INTEGER size, INTEGER workersUsed);
+static void batchFree (Batch *batch);
+static bool batchIsFull (Batch *batch);
+static void batchPush (Batch *batch, INTEGER start, INTEGER end);
+static int batchCompareByInterval (const void *data1, const void *data2);
+static int batchCompareByPosition (const void *data1, const void *data2);
+static bool batchSameGroup (Query *query1, Query *query2);
+static void batchSaveResult (Worker *worker, Query *query);
+static void batchPlanGroup (Batch *batch, Worker *worker, INTEGER firstIdx);
+static void batchAnswer (Batch *batch, Planner *planner, PathReply reply, void *context);
+static INTEGER batchBytes (Batch *batch);
+
+
+
+/******* WORKER FUNCTION PROTOTYPES *******/
+
+static void* workerRun (void *data);
+static void workerPlan (Worker *worker);
+
+
+
+/******* SUBSCRIPTION FUNCTION PROTOTYPES *******/
+
+static Subscriptions* subscriptionsInit (INTEGER size);
+static void subscriptionsFree (Subscriptions *subscriptions);
+static INTEGER subscriptionsLowerBound (Subscriptions *subscriptions, INTEGER start, INTEGER end);
+static bool subscriptionsInsert (Subscriptions *subscriptions, INTEGER start, INTEGER end);
+static bool subscriptionsDelete (Subscriptions *subscriptions, INTEGER start, INTEGER end);
+static void subscriptionsBuild (Subscriptions *subscriptions);
+static void subscriptionsMark (Subscriptions *subscriptions, INTEGER station);
+static void subscriptionsMarkNode (Subscriptions *subscriptions, INTEGER node, INTEGER first, INTEGER last, INTEGER count, INTEGER station);
+static void subscriptionsMarkIdx (Subscriptions *subscriptions, INTEGER idx);
+static void subscriptionsMarkAll (Subscriptions *subscriptions);
+static void subscriptionsReplan (void *context, KEY *path, INTEGER length);
+static void subscriptionsStore (Subscription *subscription, KEY *path, INTEGER length);
+static int subscriptionsCompareIdx (const void *data1, const void *data2);
+static INTEGER subscriptionsBytes (Subscriptions *subscriptions);
+
+
+
+#ifndef PLANNER_LIBRARY
+
+/******* HIGHWAY FUNCTION PROTOTYPES *******/
+
+static Highways* highwaysInit (Planner *planner, INTEGER workersUsed);
+static void highwaysFree (Highways *highways);
+static Shard* highwaysGetShard (Highways *highways, INTEGER highway);
+static void highwaysPush (Highways *highways, INTEGER highway, int command, Input *input);
+static bool highwaysIsFull (Highways *highways);
+static void highwaysRun (Highways *highways);
+static void highwaysFlush (Highways *highways);
+static void* highwaysRunWorker (void *data);
+static void highwaysWork (Highways *highways, INTEGER workerId);
+
+#endif
+
+
+
+/******* STATS FUNCTION PROTOTYPES *******/
+
+static INTEGER statsClock ();
+static INTEGER statsBucketIdx (INTEGER value);
+static void statsRecord (Histogram *histogram, INTEGER value);
+static void statsCount (atomic_long *counter);
+#ifndef PLANNER_LIBRARY
+static Stats* statsInit (char *path);
+static void statsFree (Stats *stats);
+static INTEGER statsBucketValue (INTEGER bucketIdx);
+static INTEGER statsPercentile (Histogram *histogram, double fraction);
+static void statsDumpHistogram (FILE *file, char *name, Histogram *histogram);
+static void statsDump (Stats *stats);
+#endif
+
+
+
+/******* SNAPSHOT FUNCTION PROTOTYPES *******/
+
+static bool snapshotSave (char *path, Planner *planner);
+static bool snapshotLoad (char *path, Planner *planner);
+static bool snapshotIsValid (INTEGER *data, INTEGER length, Vector *bestCars);
 
 
 
 /******* OTHER FUNCTION PROTOTYPES *******/
 
-void raiseCustomError (char *message);
-bool isDigit (int character);
-INTEGER readInt ();
-bool addStation (HashTable *stations, INTEGER station);
-void delStation (HashTable *stations, INTEGER station);
-void addCar (HashTable *stations, INTEGER station, INTEGER car, bool print);
-void delCar (HashTable *stations, INTEGER station, INTEGER car);
-bool getPath (HashTable *stations, INTEGER start, INTEGER end, Vector *path);
-INTEGER getScore (Vector* bestCars, INTEGER sourceIdx, INTEGER targetIdx);
-bool getStraightPath (Vector *bestCars, INTEGER startIdx, INTEGER endIdx, Vector *path);
-bool getReversedPath (Vector *bestCars, INTEGER startIdx, INTEGER endIdx, Vector *path);
+static void raiseCustomError (char *message);
+static bool isKey (INTEGER value);
+static INTEGER getBestCar (HTNode *stationNode);
+static void setBestCar (Planner *planner, INTEGER station, INTEGER car);
+static void copyPath (void *context, KEY *path, INTEGER length);
+static void replyPath (void *context, KEY *path, INTEGER length);
+static planner_int_t* widenPath (Planner *planner, KEY *path, INTEGER length);
+static bool getPath (Vector *bestCars, Tree *tree, INTEGER start, INTEGER end, Vector *path);
+static INTEGER getHops (Vector *bestCars, Tree *tree, INTEGER startIdx, INTEGER endIdx, Vector *layers);
+static bool getStraightLayers (Vector *bestCars, Tree *tree, INTEGER endIdx, Vector *layers);
+static bool getReversedLayers (Vector *bestCars, Tree *tree, INTEGER endIdx, Vector *layers);
+static void getStraightStops (Vector *bestCars, Tree *tree, INTEGER endIdx, Vector *path);
+static void getReversedStops (Vector *bestCars, Tree *tree, INTEGER endIdx, Vector *path);
+
+
+
+#ifndef PLANNER_LIBRARY
+
+/******* COMMAND LINE FUNCTION PROTOTYPES *******/
+
+static bool isDigit (int character);
+static INTEGER getWorkersCount ();
+static bool isPipelined ();
+static bool isBinary ();
+static void reportMemory (Planner *planner, char *path);
+static void runCommand (Input *input, Planner *planner, Output *output, int command);
+static void printResult (Output *output, Planner *planner, bool done, char *doneMessage, char *failedMessage);
+static void printStops (Output *output, planner_int_t *path, INTEGER length);
+static void printPath (void *context, planner_int_t *path, INTEGER length);
+static void printUpdate (void *context, INTEGER start, INTEGER end, planner_int_t *path, INTEGER length);
+static void printHops (Output *output, INTEGER hops);
+
+#endif
+
+
+
+/******* GLOBALS *******/
+
+#ifndef PLANNER_LIBRARY
+static Output *output = NULL;
+static Highways *highways = NULL;
+#endif
+static Stats *stats = NULL;
 
 
 
 /******* MAIN *******/
 
+#ifndef PLANNER_LIBRARY
+
 int main () {
-    char command[COMMAND_SIZE];
-    INTEGER counter, station, car, start, end;
-    bool added, exists;
+    int command;
+    INTEGER highway;
 
-    HashTable *stations = htInit(HT_INITIAL_SIZE);
-    Vector *path;
+    stats = statsInit(getenv(STATS_VARIABLE));
+    Input *input = inputInit(INPUT_BUFFER_SIZE);
+    output = outputInit(OUTPUT_BUFFER_SIZE);
+    input->binary = output->binary = isBinary();
+    if (isPipelined()) {
+        inputStartParser(input);
+        outputStartWriter(output);
+    }
+    Planner *planner = plannerInit(getWorkersCount(), printPath, output);
+    if (getenv(SNAPSHOT_LOAD_VARIABLE) != NULL && !plannerLoad(planner, getenv(SNAPSHOT_LOAD_VARIABLE))) {
+        raiseCustomError("unable to load snapshot");
+    }
 
-    while (scanf("%s", command) != EOF) {
-        if (strcmp(command, ADD_STATION) == 0) {
-            station = readInt();
-            counter = readInt();
-            added = addStation(stations, station);
-            for (INTEGER i = 1; i <= counter; i++) {
-                car = readInt();
-                if (added) {
-                    addCar(stations, station, car, false);
-                }
-            }
+    // commands run here until one names a highway other than the default,
+    // from then on every command goes through the shards to keep the replies in order
+    while ((command = inputReadCommand(input)) != EOF) {
+        highway = DEFAULT_HIGHWAY;
+        if (command == HIGHWAY_COMMAND) {
+            highway = inputReadInt(input);
+            command = inputReadCommand(input);
         }
-        else if (strcmp(command, DEL_STATION) == 0) {
-            station = readInt();
-            delStation(stations, station);
-        }
-        else if (strcmp(command, ADD_CAR) == 0) {
-            station = readInt();
-            car = readInt();
-            addCar(stations, station, car, true);
-        }
-        else if (strcmp(command, DEL_CAR) == 0) {
-            station = readInt();
-            car = readInt();
-            delCar(stations, station, car);
-        }
-        else if (strcmp(command, FIND_PATH) == 0) {
-            start = readInt();
-            end = readInt();
-            path = vectorInit(VECTOR_INITIAL_SIZE);
-            exists = getPath(stations, start, end, path);
-            if (exists) {
-                for (INTEGER idx = 0; idx < path->used - 1; idx++) {
-                    printf("%ld ", vectorGetStation(path, idx));
-                }
-                printf("%ld\n", vectorGetStation(path, path->used - 1));
-            }
-            else {
-                printf(NO_PATH);
-            }
-            vectorFree(path);
+        if (highways == NULL && highway == DEFAULT_HIGHWAY) {
+            runCommand(input, planner, output, command);
+            continue;
         }
-        else {
-            raiseCustomError("unable to execute command");
+        if (highways == NULL) {
+            highways = highwaysInit(planner, getWorkersCount());
         }
+        highwaysPush(highways, highway, command, input);
+        if (highwaysIsFull(highways)) {
+            highwaysRun(highways);
+        }
+    }
+    if (highways != NULL) {
+        highwaysRun(highways);
+        highwaysFree(highways);
+        highways = NULL;
     }
 
-    htFree(stations);
+    plannerAnswerPaths(planner);
+    if (getenv(SNAPSHOT_SAVE_VARIABLE) != NULL && !plannerSave(planner, getenv(SNAPSHOT_SAVE_VARIABLE))) {
+        raiseCustomError("unable to save snapshot");
+    }
+    if (getenv(MEMORY_VARIABLE) != NULL) {
+        reportMemory(planner, getenv(MEMORY_VARIABLE));
+    }
+
+    plannerFree(planner);
+    inputFree(input);
+    outputFree(output);
+    if (stats != NULL) {
+        statsDump(stats);
+        statsFree(stats);
+    }
     return 0;
 };
 
+#endif
 
 
-/******* OTHER FUNCTIONS *******/
 
-void raiseCustomError (char *message) {
-    printf("[ERROR]: %s\n", message);
-    exit(EXIT_FAILURE);
-};
+/******* PLANNER FUNCTIONS *******/
 
-bool isDigit (int character) {
-    return character >= '0' && character <= '9';
+Planner* plannerInit (INTEGER workers, PlannerReply reply, void *context) {
+    Planner *planner = malloc(sizeof(Planner));
+    planner->stations = htInit(HT_INITIAL_SIZE);
+    planner->bestCars = vectorInit(VECTOR_INITIAL_SIZE);
+    planner->cache = cacheInit(CACHE_SIZE);
+    planner->jump = jumpInit();
+    planner->tree = treeInit();
+    planner->batch = batchInit(BATCH_SIZE, workers < 1 ? 1 : workers > WORKERS_MAX ? WORKERS_MAX : workers);
+    planner->subscriptions = subscriptionsInit(SUBSCRIPTIONS_INITIAL_SIZE);
+    planner->reply = reply;
+    planner->context = context;
+    planner->wide = NULL;
+    planner->wideSize = 0;
+    return planner;
 }
 
-INTEGER readInt () {
-    INTEGER value = 0;
-    int character = getchar_unlocked();
-    while (!isDigit(character)) {
-        character = getchar_unlocked();
-    }
-    while (isDigit(character)) {
-        value = 10 * value + (character - '0');
-        character = getchar_unlocked();
-    }
-    return value;
+void plannerFree (Planner *planner) {
+    plannerAnswerPaths(planner);
+    htFree(planner->stations);
+    vectorFree(planner->bestCars);
+    cacheFree(planner->cache);
+    jumpFree(planner->jump);
+    treeFree(planner->tree);
+    batchFree(planner->batch);
+    subscriptionsFree(planner->subscriptions);
+    free(planner->wide);
+    free(planner);
 }
 
-bool addStation (HashTable *stations, INTEGER station) {
-    HTNode *node = htSearch(stations, station, NULL);
-    if (node != NULL) {
-        printf(NOT_ADDED);
+bool plannerAddStation (Planner *planner, INTEGER station) {
+    plannerAnswerPaths(planner);
+    if (!isKey(station) || htSearch(planner->stations, station) != NULL) {
         return false;
     };
-    htInsert(stations, station);
-    printf(ADDED);
+    htInsert(planner->stations, station);
+    INTEGER idx = vectorLowerBound(planner->bestCars, station);
+    vectorInsert(planner->bestCars, idx, station, 0);
+    cacheInvalidate(planner->cache, station);
+    jumpMarkStations(planner->jump);
+    treeInsert(planner->tree, idx, station, 0);
+    subscriptionsMark(planner->subscriptions, station);
     return true;
 }
 
-void delStation (HashTable *stations, INTEGER station) {
-    bool deleted = htDelete(stations, station);
-    if (deleted) {
-        printf(DEMOLISHED);
-    }
-    else {
-        printf(NOT_DEMOLISHED);
+bool plannerDelStation (Planner *planner, INTEGER station) {
+    plannerAnswerPaths(planner);
+    if (!isKey(station) || !htDelete(planner->stations, station)) {
+        return false;
     }
+    INTEGER idx = vectorLowerBound(planner->bestCars, station);
+    vectorDelete(planner->bestCars, idx);
+    cacheInvalidate(planner->cache, station);
+    jumpMarkStations(planner->jump);
+    treeDelete(planner->tree, idx);
+    subscriptionsMark(planner->subscriptions, station);
+    return true;
 }
 
-void addCar (HashTable *stations, INTEGER station, INTEGER car, bool print) {
-    HTNode *stationNode = htSearch(stations, station, NULL);
+bool plannerAddCar (Planner *planner, INTEGER station, INTEGER car) {
+    plannerAnswerPaths(planner);
+    if (!isKey(station) || !isKey(car)) {
+        return false;
+    }
+    HTNode *stationNode = htSearch(planner->stations, station);
     if (stationNode == NULL) {
-        if (print) {
-            printf(NOT_ADDED);
-        };
-        return;
+        return false;
     }
     if (stationNode->value == NULL) {
         stationNode->value = setInit(HT_INITIAL_SIZE);
+        stationNode->maxHeap = heapInit(HEAP_INITIAL_SIZE);
     }
-    setInsert(stationNode->value, car);
-    if (print) {
-        printf(ADDED);
-    };
+    if (setInsert(stationNode->value, car)) {
+        heapPush(stationNode->maxHeap, car);
+    }
+    setBestCar(planner, station, getBestCar(stationNode));
+    return true;
 }
 
-void delCar (HashTable *stations, INTEGER station, INTEGER car) {
-    HTNode *stationNode = htSearch(stations, station, NULL);
-    if (stationNode == NULL || stationNode->value == NULL) {
-        printf(NOT_SCRAPPED);
-        return;
+bool plannerDelCar (Planner *planner, INTEGER station, INTEGER car) {
+    plannerAnswerPaths(planner);
+    if (!isKey(station) || !isKey(car)) {
+        return false;
     }
-    bool deleted = setDelete(stationNode->value, car);
-    if (deleted) {
-        printf(SCRAPPED);
+    HTNode *stationNode = htSearch(planner->stations, station);
+    if (stationNode == NULL || stationNode->value == NULL || !setDelete(stationNode->value, car)) {
+        return false;
     }
-    else {
-        printf(NOT_SCRAPPED);
+    setBestCar(planner, station, getBestCar(stationNode));
+    return true;
+}
+
+INTEGER plannerGetPath (Planner *planner, INTEGER start, INTEGER end, planner_int_t *path, INTEGER size) {
+    PathBuffer buffer = {path, size, PLANNER_NO_PATH};
+    // a single query goes through the batch too, to share its cache and buffers
+    plannerAnswerPaths(planner);
+    if (!isKey(start) || !isKey(end)) {
+        return PLANNER_NO_PATH;
     }
+    batchPush(planner->batch, start, end);
+    batchAnswer(planner->batch, planner, copyPath, &buffer);
+    return buffer.length;
 }
 
-bool getPath (HashTable *stations, INTEGER start, INTEGER end, Vector *path) {
-    if (start == end) {
-        vectorPush(path, start, UNDEFINED);
-        return true;
+INTEGER plannerCountHops (Planner *planner, INTEGER start, INTEGER end) {
+    plannerAnswerPaths(planner);
+    if (!isKey(start) || !isKey(end) || htSearch(planner->stations, start) == NULL || htSearch(planner->stations, end) == NULL) {
+        return PLANNER_NO_PATH;
     }
-    Vector *bestCars = vectorInit(stations->used);
-    HTNode *station;
-    Set *cars;
-    SetNode *car;
-    INTEGER bestCar;
-
-    htIter(stations);
-    for (station = htNext(stations); station; station = htNext(stations)) {
-        bestCar = 0;
-        cars = station->value;
-        setIter(cars);
-        for (car = setNext(cars); car; car = setNext(cars)) {
-            if (car->key > bestCar) {
-                bestCar = car->key;
-            }
+    INTEGER startIdx = vectorFindStation(planner->bestCars, start);
+    INTEGER endIdx = vectorFindStation(planner->bestCars, end);
+    Jump *jump = planner->jump;
+    INTEGER hops;
+    // while the tables are stale the hops are counted by sweeping the layers, and
+    // the tables are rebuilt once the layers swept since the last change are as many
+    // as the stations a rebuild goes through
+    if (!jumpIsClean(jump) && jump->swept >= vectorLength(planner->bestCars)) {
+        jumpUpdate(jump, planner->bestCars);
+    }
+    if (jumpIsClean(jump)) {
+        hops = jumpCountHops(jump, startIdx, endIdx);
+    } else {
+        if (planner->tree->dirty) {
+            treeBuild(planner->tree, planner->bestCars);
         }
-        vectorPush(bestCars, station->key, bestCar);
+        hops = getHops(planner->bestCars, planner->tree, startIdx, endIdx, jump->layers);
+        jump->swept += vectorLength(jump->layers);
     }
-    vectorSortByStation(bestCars);
+    return hops < 0 ? PLANNER_NO_PATH : hops;
+}
 
-    INTEGER startIdx = vectorFindStation(bestCars, start);
-    INTEGER endIdx = vectorFindStation(bestCars, end);
-    vectorPush(path, start, UNDEFINED);
-    bool exists;
-    if (start < end) {
-        exists = getStraightPath(bestCars, startIdx, endIdx, path);
-    } else {
-        exists = getReversedPath(bestCars, startIdx, endIdx, path);
+bool plannerQueuePath (Planner *planner, INTEGER start, INTEGER end) {
+    if (planner->reply == NULL) {
+        return false;
     }
-    vectorFree(bestCars);
-    return exists;
-};
+    batchPush(planner->batch, start, end);
+    if (batchIsFull(planner->batch)) {
+        plannerAnswerPaths(planner);
+    }
+    return true;
+}
 
-INTEGER getScore (Vector* bestCars, INTEGER sourceIdx, INTEGER targetIdx) {
-    return vectorGetStationsDist(bestCars, sourceIdx, targetIdx) + vectorGetCar(bestCars, targetIdx);
+void plannerAnswerPaths (Planner *planner) {
+    batchAnswer(planner->batch, planner, replyPath, planner);
 }
 
-bool getStraightPath (Vector *bestCars, INTEGER startIdx, INTEGER endIdx, Vector *path) {
-    INTEGER currIdx = startIdx, nextIdx, bestIdx;
-    while (currIdx < endIdx) {
-        nextIdx = currIdx + 1;
-        bestIdx = -1;
-        
-        while (nextIdx <= endIdx && vectorGetStationsDist(bestCars, currIdx, nextIdx) <= vectorGetCar(bestCars, currIdx)) {
-            if (bestIdx == -1 || nextIdx == endIdx || getScore(bestCars, currIdx, nextIdx) >= getScore(bestCars, currIdx, bestIdx)) {
-                bestIdx = nextIdx;
-            }
-            nextIdx++;
-        }
-        if (bestIdx == -1) {
-            return false;
-        }
-        vectorPush(path, vectorGetStation(bestCars, bestIdx), UNDEFINED);
-        currIdx = bestIdx;
-    }
-    
-    INTEGER targetPathIdx = vectorLength(path) - 1;
-    INTEGER currPathIdx = vectorLength(path) - 2;
-    currIdx = vectorFindStation(bestCars, vectorGetStation(path, currPathIdx));
-    
-    while (currPathIdx > 0) {
-        INTEGER prevStation = vectorGetStation(path, currPathIdx - 1);
-        
-        while (vectorGetStation(bestCars, currIdx) > prevStation) {
-            INTEGER car = vectorGetCar(bestCars, currIdx);
-            if (vectorGetStation(path, targetPathIdx) - vectorGetStation(bestCars, currIdx) <= car) {
-                vectorSet(path, currPathIdx, vectorGetStation(bestCars, currIdx), UNDEFINED);
-            }
-            currIdx--;
-        }
-        currPathIdx--;
-        targetPathIdx--;
+void plannerSetReply (Planner *planner, PlannerReply reply, void *context) {
+    plannerAnswerPaths(planner);
+    planner->reply = reply;
+    planner->context = context;
+}
+
+bool plannerSave (Planner *planner, char *path) {
+    plannerAnswerPaths(planner);
+    return snapshotSave(path, planner);
+}
+
+bool plannerLoad (Planner *planner, char *path) {
+    plannerAnswerPaths(planner);
+    if (!snapshotLoad(path, planner)) {
+        return false;
     }
+    subscriptionsMarkAll(planner->subscriptions);
     return true;
 }
 
-bool getReversedPath (Vector *bestCars, INTEGER startIdx, INTEGER endIdx, Vector *path) {
-    INTEGER currIdx = startIdx, nextIdx, bestIdx;
-    while (currIdx > endIdx) {
-        nextIdx = currIdx - 1;
-        bestIdx = -1;
-        
-        while (nextIdx >= endIdx && vectorGetStationsDist(bestCars, currIdx, nextIdx) <= vectorGetCar(bestCars, currIdx)) {
-            if (bestIdx == -1 || nextIdx == endIdx || getScore(bestCars, currIdx, nextIdx) >= getScore(bestCars, currIdx, bestIdx)) {
-                bestIdx = nextIdx;
-            }
-            nextIdx--;
-        }
-        if (bestIdx == -1) {
-            return false;
+bool plannerSubscribe (Planner *planner, INTEGER start, INTEGER end) {
+    plannerAnswerPaths(planner);
+    if (!isKey(start) || !isKey(end)) {
+        return false;
+    }
+    return subscriptionsInsert(planner->subscriptions, start, end);
+}
+
+bool plannerUnsubscribe (Planner *planner, INTEGER start, INTEGER end) {
+    plannerAnswerPaths(planner);
+    if (!isKey(start) || !isKey(end)) {
+        return false;
+    }
+    return subscriptionsDelete(planner->subscriptions, start, end);
+}
+
+INTEGER plannerRefreshSubscriptions (Planner *planner) {
+    Subscriptions *subscriptions = planner->subscriptions;
+    Subscription *subscription;
+    INTEGER kept = 0;
+    plannerAnswerPaths(planner);
+    // the marked routes are planned through the batch, whose replies come back in order
+    subscriptions->replanned = 0;
+    for (INTEGER pendingIdx = 0; pendingIdx < subscriptions->pendingUsed; pendingIdx++) {
+        subscription = subscriptions->data + subscriptions->pending[pendingIdx];
+        // routes from or to a missing station are not planned, and their replies are skipped
+        if (subscription->marked && (htSearch(planner->stations, subscription->start) == NULL || htSearch(planner->stations, subscription->end) == NULL)) {
+            subscription->marked = false;
+            subscriptionsStore(subscription, NULL, PLANNER_NO_PATH);
         }
-        vectorPush(path, vectorGetStation(bestCars, bestIdx), UNDEFINED);
-        currIdx = bestIdx;
-    }
-    
-    INTEGER currPathIdx = vectorLength(path) - 2;
-    INTEGER prevPathIdx, nextPathIdx;
-    INTEGER prevIdx, newIdx;
-    bool changed;
-    
-    while (currPathIdx > 0) {
-        nextPathIdx = currPathIdx + 1;
-        prevPathIdx = currPathIdx - 1;
-        
-        prevIdx = vectorFindStation(bestCars, vectorGetStation(path, prevPathIdx));
-        currIdx = vectorFindStation(bestCars, vectorGetStation(path, currPathIdx));
-        nextIdx = vectorFindStation(bestCars, vectorGetStation(path, nextPathIdx));
-        
-        changed = false;
-        
-        newIdx = currIdx - 1;
-        while (newIdx > nextIdx) {
-            if (vectorGetStationsDist(bestCars, prevIdx, newIdx) <= vectorGetCar(bestCars, prevIdx) && vectorGetStationsDist(bestCars, newIdx, nextIdx) <= vectorGetCar(bestCars, newIdx)) {
-                vectorSet(path, currPathIdx, vectorGetStation(bestCars, newIdx), UNDEFINED);
-                changed = true;
+        else if (subscription->marked) {
+            batchPush(planner->batch, subscription->start, subscription->end);
+            if (batchIsFull(planner->batch)) {
+                batchAnswer(planner->batch, planner, subscriptionsReplan, subscriptions);
             }
-            newIdx--;
         }
-
-        if (changed) {
-            currPathIdx = vectorLength(path) - 2;
-        }
-        else {
-            currPathIdx--;
+    }
+    batchAnswer(planner->batch, planner, subscriptionsReplan, subscriptions);
+    for (INTEGER pendingIdx = 0; pendingIdx < subscriptions->pendingUsed; pendingIdx++) {
+        if (subscriptions->data[subscriptions->pending[pendingIdx]].changed) {
+            subscriptions->pending[kept++] = subscriptions->pending[pendingIdx];
         }
     }
-    return true;
+    subscriptions->pendingUsed = kept;
+    qsort(subscriptions->pending, kept, sizeof(INTEGER), subscriptionsCompareIdx);
+    return kept;
 }
 
+void plannerPublishSubscriptions (Planner *planner, PlannerUpdate update, void *context) {
+    Subscriptions *subscriptions = planner->subscriptions;
+    Subscription *subscription;
+    plannerRefreshSubscriptions(planner);
+    for (INTEGER pendingIdx = 0; pendingIdx < subscriptions->pendingUsed; pendingIdx++) {
+        subscription = subscriptions->data + subscriptions->pending[pendingIdx];
+        subscription->changed = false;
+        update(context, subscription->start, subscription->end, widenPath(planner, subscription->path, subscription->length), subscription->length);
+    }
+    subscriptions->pendingUsed = 0;
+}
 
+void plannerReportMemory (Planner *planner, FILE *file) {
+    INTEGER sets = 0, setsSlack = 0, heaps = 0, total;
+    for (HTNode *node = htNext(planner->stations, NULL); node; node = htNext(planner->stations, node)) {
+        sets += setBytes(node->value);
+        setsSlack += setSlack(node->value);
+        heaps += heapBytes(node->maxHeap);
+    }
+    total = htBytes(planner->stations) + sets + heaps + vectorBytes(planner->bestCars) + treeBytes(planner->tree) + jumpBytes(planner->jump) + cacheBytes(planner->cache) + batchBytes(planner->batch) + subscriptionsBytes(planner->subscriptions);
+    fprintf(file, "# memory NAME BYTES\n");
+    fprintf(file, "memory key.bits %d\n", PLANNER_KEY_BITS);
+    fprintf(file, "memory stations.buckets %ld\n", htBytes(planner->stations));
+    fprintf(file, "memory stations.slack %ld\n", htSlack(planner->stations));
+    fprintf(file, "memory cars.sets %ld\n", sets);
+    fprintf(file, "memory cars.slack %ld\n", setsSlack);
+    fprintf(file, "memory cars.heaps %ld\n", heaps);
+    fprintf(file, "memory index %ld\n", vectorBytes(planner->bestCars));
+    fprintf(file, "memory index.slack %ld\n", vectorSlack(planner->bestCars));
+    fprintf(file, "memory tree %ld\n", treeBytes(planner->tree));
+    fprintf(file, "memory jump %ld\n", jumpBytes(planner->jump));
+    fprintf(file, "memory cache %ld\n", cacheBytes(planner->cache));
+    fprintf(file, "memory batch %ld\n", batchBytes(planner->batch));
+    fprintf(file, "memory subscriptions %ld\n", subscriptionsBytes(planner->subscriptions));
+    fprintf(file, "memory total %ld\n", total);
+}
 
-/******* SET FUNCTIONS *******/
 
-Set* setInit (INTEGER size) {
-    Set *set = malloc(sizeof(Set));
-    set->data = malloc(size * sizeof(SetNode*));
-    set->size = size;
-    set->used = 0;
-    for (INTEGER bucketIdx = 0; bucketIdx < size; bucketIdx++) {
-        set->data[bucketIdx] = NULL;
+
+/******* OTHER FUNCTIONS *******/
+static void raiseCustomError (char *message) {
+#ifndef PLANNER_LIBRARY
+    // the commands already queued for the highways are answered before the error,
+    // unless the error comes from running them
+    if (highways != NULL && !highways->running) {
+        highwaysFlush(highways);
     }
-    return set;
+    if (output != NULL) {
+        outputFlush(output);
+    }
+#endif
+    printf("[ERROR]: %s\n", message);
+    exit(EXIT_FAILURE);
 };
 
-INTEGER setBucketIdx (Set *set, INTEGER key) {
-    return key % set->size;
+static bool isKey (INTEGER value) {
+    // the empty slots of the car sets hold a negative key, and narrow builds drop the high bits
+    return value >= 0 && (KEY) value == value;
 }
 
-SetNode** setBucket (Set *set, INTEGER key) {
-    INTEGER index = setBucketIdx(set, key);
-    return set->data + index;
+static INTEGER getBestCar (HTNode *stationNode) {
+    Set *cars = stationNode->value;
+    Heap *maxHeap = stationNode->maxHeap;
+    SetNode *car;
+    INTEGER iterator;
+    // scrapped cars stay in the heap until they reach the top, or until they outnumber the others
+    if (heapLength(maxHeap) > HEAP_STALE_FACTOR * cars->used + HEAP_INITIAL_SIZE) {
+        heapClear(maxHeap);
+        setIter(&iterator);
+        for (car = setNext(cars, &iterator); car; car = setNext(cars, &iterator)) {
+            heapPush(maxHeap, car->key);
+        }
+    }
+    while (heapLength(maxHeap) > 0 && setSearch(cars, heapTop(maxHeap)) == NULL) {
+        heapPop(maxHeap);
+    }
+    if (heapLength(maxHeap) == 0) {
+        return 0;
+    }
+    return heapTop(maxHeap);
 }
 
-void setIter (Set *set) {
-    if (set == NULL) {
+static void setBestCar (Planner *planner, INTEGER station, INTEGER car) {
+    INTEGER idx = vectorLowerBound(planner->bestCars, station);
+    if (vectorGetCar(planner->bestCars, idx) == car) {
         return;
     }
-    set->iterator = NULL;
-    set->iterationFinished = false;
+    vectorSet(planner->bestCars, idx, station, car);
+    cacheInvalidate(planner->cache, station);
+    jumpMarkCar(planner->jump, idx);
+    treeUpdate(planner->tree, idx, station, car);
+    subscriptionsMark(planner->subscriptions, station);
 }
 
-SetNode* setNext (Set *set) {
-    if (set == NULL || set->iterationFinished) {
-        return NULL;
-    }
-    if (set->iterator != NULL && set->iterator->next != NULL) {
-        set->iterator = set->iterator->next;
-        return set->iterator;
+static void copyPath (void *context, KEY *path, INTEGER length) {
+    PathBuffer *buffer = context;
+    buffer->length = length;
+    for (INTEGER idx = 0; idx < length && idx < buffer->size; idx++) {
+        buffer->data[idx] = path[idx];
     }
-    SetNode *next;
+}
+
+static void replyPath (void *context, KEY *path, INTEGER length) {
+    Planner *planner = context;
+    planner->reply(planner->context, widenPath(planner, path, length), length);
+}
+
+static planner_int_t* widenPath (Planner *planner, KEY *path, INTEGER length) {
+#if PLANNER_KEY_BITS == 32
+    // narrow keys are copied into a buffer of the planner, valid until the next reply
+    if (length > planner->wideSize) {
+        planner->wideSize = length;
+        planner->wide = realloc(planner->wide, length * sizeof(planner_int_t));
+    }
+    for (INTEGER idx = 0; idx < length; idx++) {
+        planner->wide[idx] = path[idx];
+    }
+    return planner->wide;
+#else
+    (void) planner;
+    (void) length;
+    return path;
+#endif
+}
+
+static bool getPath (Vector *bestCars, Tree *tree, INTEGER start, INTEGER end, Vector *path) {
+    if (start == end) {
+        vectorPush(path, start, UNDEFINED);
+        return true;
+    }
+    INTEGER startIdx = vectorFindStation(bestCars, start);
+    INTEGER endIdx = vectorFindStation(bestCars, end);
+    vectorPush(path, start, startIdx);
+    if (start < end) {
+        if (!getStraightLayers(bestCars, tree, endIdx, path)) {
+            return false;
+        }
+        getStraightStops(bestCars, tree, endIdx, path);
+    } else {
+        if (!getReversedLayers(bestCars, tree, endIdx, path)) {
+            return false;
+        }
+        getReversedStops(bestCars, tree, endIdx, path);
+    }
+    return true;
+};
+
+static INTEGER getHops (Vector *bestCars, Tree *tree, INTEGER startIdx, INTEGER endIdx, Vector *layers) {
+    bool reached;
+    vectorTruncate(layers, 0);
+    vectorPush(layers, vectorGetStation(bestCars, startIdx), startIdx);
+    if (startIdx == endIdx) {
+        return 0;
+    }
+    // every layer after the start is one more stop, and the stops themselves are not needed
+    reached = startIdx < endIdx ? getStraightLayers(bestCars, tree, endIdx, layers) : getReversedLayers(bestCars, tree, endIdx, layers);
+    return reached ? vectorLength(layers) - 1 : -1;
+}
+
+static bool getStraightLayers (Vector *bestCars, Tree *tree, INTEGER endIdx, Vector *layers) {
+    KEY *stations = bestCars->stations, *cars = bestCars->cars;
+    INTEGER startIdx = vectorGetCar(layers, 0);
+    INTEGER layerStart = startIdx, layerEnd = startIdx, nextEnd, farthest, scanned = 0;
+
+    // stations reachable with the same number of stops form contiguous layers,
+    // each slot after the start holds the index of the last station of a layer;
+    // short layers are scanned, long ones are looked up in the tree
+    while (layerEnd < endIdx) {
+        if (layerEnd - layerStart < TREE_SCAN_LIMIT) {
+            farthest = scanMaxSum(stations, cars, layerStart, layerEnd);
+            scanned += layerEnd - layerStart + 1;
+        } else {
+            farthest = treeMaxHigh(tree, layerStart, layerEnd);
+        }
+        nextEnd = vectorLastAtMost(bestCars, layerEnd + 1, endIdx, farthest);
+        if (nextEnd == layerEnd) {
+            break;
+        }
+        layerStart = layerEnd + 1;
+        layerEnd = nextEnd;
+        vectorPush(layers, stations[layerEnd], layerEnd);
+    }
+    if (stats != NULL) {
+        statsRecord(&stats->scanned, scanned);
+    }
+    return layerEnd >= endIdx;
+}
+
+static bool getReversedLayers (Vector *bestCars, Tree *tree, INTEGER endIdx, Vector *layers) {
+    KEY *stations = bestCars->stations, *cars = bestCars->cars;
+    INTEGER startIdx = vectorGetCar(layers, 0);
+    INTEGER layerStart = startIdx, layerEnd = startIdx, nextEnd, nearest, scanned = 0;
+
+    // same layers as the straight path, with each slot holding the first station of a layer
+    while (layerEnd > endIdx) {
+        if (layerStart - layerEnd < TREE_SCAN_LIMIT) {
+            nearest = scanMinDifference(stations, cars, layerEnd, layerStart);
+            scanned += layerStart - layerEnd + 1;
+        } else {
+            nearest = treeMinLow(tree, layerEnd, layerStart);
+        }
+        nextEnd = vectorFirstAtLeast(bestCars, layerEnd - 1, endIdx, nearest);
+        if (nextEnd == layerEnd) {
+            break;
+        }
+        layerStart = layerEnd - 1;
+        layerEnd = nextEnd;
+        vectorPush(layers, stations[layerEnd], layerEnd);
+    }
+    if (stats != NULL) {
+        statsRecord(&stats->scanned, scanned);
+    }
+    return layerEnd <= endIdx;
+}
+
+static void getStraightStops (Vector *bestCars, Tree *tree, INTEGER endIdx, Vector *path) {
+    KEY *stations = bestCars->stations, *cars = bestCars->cars;
+    INTEGER currIdx, scanEnd, targetIdx = endIdx, fixups = 0;
+    vectorSet(path, vectorLength(path) - 1, stations[endIdx], endIdx);
+
+    // the layers are replaced in place, from the end, by the closest station
+    // of each layer that reaches the following stop: the first few stations
+    // of the layer are scanned, the tree finds it past them
+    for (INTEGER pathIdx = vectorLength(path) - 2; pathIdx > 0; pathIdx--) {
+        currIdx = vectorGetCar(path, pathIdx - 1) + 1;
+        scanEnd = currIdx + TREE_SCAN_LIMIT - 1 < targetIdx ? currIdx + TREE_SCAN_LIMIT - 1 : targetIdx;
+        fixups -= currIdx;
+        currIdx = scanFirstSumAtLeast(stations, cars, currIdx, scanEnd, stations[targetIdx]);
+        if (currIdx > scanEnd) {
+            currIdx = treeFirstHigh(tree, currIdx, stations[targetIdx]);
+        }
+        fixups += currIdx;
+        vectorSet(path, pathIdx, stations[currIdx], currIdx);
+        targetIdx = currIdx;
+    }
+    if (stats != NULL) {
+        statsRecord(&stats->stops, vectorLength(path));
+        statsRecord(&stats->fixups, fixups);
+    }
+}
+
+static void getReversedStops (Vector *bestCars, Tree *tree, INTEGER endIdx, Vector *path) {
+    KEY *stations = bestCars->stations, *cars = bestCars->cars;
+    INTEGER currIdx, scanEnd, lastIdx = vectorLength(bestCars) - 1, targetIdx = endIdx, fixups = 0;
+    vectorSet(path, vectorLength(path) - 1, stations[endIdx], endIdx);
+
+    for (INTEGER pathIdx = vectorLength(path) - 2; pathIdx > 0; pathIdx--) {
+        currIdx = vectorGetCar(path, pathIdx);
+        scanEnd = currIdx + TREE_SCAN_LIMIT - 1 < lastIdx ? currIdx + TREE_SCAN_LIMIT - 1 : lastIdx;
+        fixups -= currIdx;
+        currIdx = scanFirstDifferenceAtMost(stations, cars, currIdx, scanEnd, stations[targetIdx]);
+        if (currIdx > scanEnd) {
+            currIdx = treeFirstLow(tree, currIdx, stations[targetIdx]);
+        }
+        fixups += currIdx;
+        vectorSet(path, pathIdx, stations[currIdx], currIdx);
+        targetIdx = currIdx;
+    }
+    if (stats != NULL) {
+        statsRecord(&stats->stops, vectorLength(path));
+        statsRecord(&stats->fixups, fixups);
+    }
+}
+
+
+
+#ifndef PLANNER_LIBRARY
+
+/******* COMMAND LINE FUNCTIONS *******/
+
+static bool isDigit (int character) {
+    return character >= '0' && character <= '9';
+}
+
+static INTEGER getWorkersCount () {
+    char *value = getenv(WORKERS_VARIABLE);
+    INTEGER count = value != NULL ? atol(value) : 1;
+    if (count < 1) {
+        return 1;
+    }
+    if (count > WORKERS_MAX) {
+        return WORKERS_MAX;
+    }
+    return count;
+}
+
+static bool isPipelined () {
+    char *value = getenv(PIPELINE_VARIABLE);
+    return value != NULL && atol(value) > 0;
+}
+
+static bool isBinary () {
+    char *value = getenv(BINARY_VARIABLE);
+    return value != NULL && atol(value) > 0;
+}
+
+static void reportMemory (Planner *planner, char *path) {
+    // same destinations as the stats
+    bool toStderr = path[0] == '\0' || strcmp(path, "-") == 0;
+    FILE *file = toStderr ? stderr : fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "[ERROR]: unable to write memory report\n");
+        return;
+    }
+    plannerReportMemory(planner, file);
+    if (!toStderr) {
+        fclose(file);
+    }
+}
+
+static void runCommand (Input *input, Planner *planner, Output *output, int command) {
+    INTEGER counter, station, car, start, end, begin;
+    bool added;
+    if (command != FIND_PATH_COMMAND) {
+        plannerAnswerPaths(planner);
+    }
+    begin = stats != NULL ? statsClock() : 0;
+    if (command == ADD_STATION_COMMAND) {
+        station = inputReadInt(input);
+        counter = inputReadInt(input);
+        added = plannerAddStation(planner, station);
+        for (INTEGER i = 1; i <= counter; i++) {
+            car = inputReadInt(input);
+            if (added) {
+                plannerAddCar(planner, station, car);
+            }
+        }
+        printResult(output, planner, added, ADDED, NOT_ADDED);
+    }
+    else if (command == DEL_STATION_COMMAND) {
+        station = inputReadInt(input);
+        printResult(output, planner, plannerDelStation(planner, station), DEMOLISHED, NOT_DEMOLISHED);
+    }
+    else if (command == ADD_CAR_COMMAND) {
+        station = inputReadInt(input);
+        car = inputReadInt(input);
+        printResult(output, planner, plannerAddCar(planner, station, car), ADDED, NOT_ADDED);
+    }
+    else if (command == DEL_CAR_COMMAND) {
+        station = inputReadInt(input);
+        car = inputReadInt(input);
+        printResult(output, planner, plannerDelCar(planner, station, car), SCRAPPED, NOT_SCRAPPED);
+    }
+    else if (command == FIND_PATH_COMMAND) {
+        start = inputReadInt(input);
+        end = inputReadInt(input);
+        plannerQueuePath(planner, start, end);
+    }
+    else if (command == COUNT_STOPS_COMMAND) {
+        start = inputReadInt(input);
+        end = inputReadInt(input);
+        printHops(output, plannerCountHops(planner, start, end));
+    }
+    else if (command == SUBSCRIBE_COMMAND) {
+        start = inputReadInt(input);
+        end = inputReadInt(input);
+        printResult(output, planner, plannerSubscribe(planner, start, end), SUBSCRIBED, NOT_SUBSCRIBED);
+    }
+    else if (command == UNSUBSCRIBE_COMMAND) {
+        start = inputReadInt(input);
+        end = inputReadInt(input);
+        printResult(output, planner, plannerUnsubscribe(planner, start, end), UNSUBSCRIBED, NOT_UNSUBSCRIBED);
+    }
+    else {
+        raiseCustomError(input->error != NULL ? input->error : "unable to execute command");
+    }
+    // path queries are timed when their batch is answered
+    if (stats != NULL && command != FIND_PATH_COMMAND) {
+        statsRecord(stats->commands + command, statsClock() - begin);
+    }
+}
+
+static void printResult (Output *output, Planner *planner, bool done, char *doneMessage, char *failedMessage) {
+    // the subscribed routes changed by the command follow its result, within the same reply
+    INTEGER updates = plannerRefreshSubscriptions(planner);
+    char status = (done ? BINARY_DONE : BINARY_FAILED) | (updates > 0 ? BINARY_UPDATED : 0);
+    if (output->binary) {
+        outputWrite(output, &status, 1);
+        if (updates > 0) {
+            outputWriteBinaryInt(output, updates);
+        }
+    }
+    else if (done) {
+        outputWrite(output, doneMessage, strlen(doneMessage));
+    } else {
+        outputWrite(output, failedMessage, strlen(failedMessage));
+    }
+    plannerPublishSubscriptions(planner, printUpdate, output);
+    outputEndReply(output);
+}
+
+static void printStops (Output *output, planner_int_t *path, INTEGER length) {
+    // binary paths are their length, or PLANNER_NO_PATH, followed by their stations
+    if (output->binary) {
+        outputWriteBinaryInt(output, length);
+        for (INTEGER idx = 0; idx < length; idx++) {
+            outputWriteBinaryInt(output, path[idx]);
+        }
+    }
+    else if (length == PLANNER_NO_PATH) {
+        outputWrite(output, NO_PATH, sizeof(NO_PATH) - 1);
+    }
+    else {
+        for (INTEGER idx = 0; idx < length - 1; idx++) {
+            outputWriteInt(output, path[idx]);
+            outputWrite(output, " ", 1);
+        }
+        outputWriteInt(output, path[length - 1]);
+        outputWrite(output, "\n", 1);
+    }
+}
+
+static void printPath (void *context, planner_int_t *path, INTEGER length) {
+    Output *stream = context;
+    printStops(stream, path, length);
+    outputEndReply(stream);
+}
+
+static void printUpdate (void *context, INTEGER start, INTEGER end, planner_int_t *path, INTEGER length) {
+    Output *stream = context;
+    // an update is the ends of the route followed by its new path
+    if (stream->binary) {
+        outputWriteBinaryInt(stream, start);
+        outputWriteBinaryInt(stream, end);
+    } else {
+        outputWrite(stream, UPDATED, sizeof(UPDATED) - 1);
+        outputWriteInt(stream, start);
+        outputWrite(stream, " ", 1);
+        outputWriteInt(stream, end);
+        outputWrite(stream, ": ", 2);
+    }
+    printStops(stream, path, length);
+}
+
+static void printHops (Output *output, INTEGER hops) {
+    if (output->binary) {
+        outputWriteBinaryInt(output, hops);
+    }
+    else if (hops == PLANNER_NO_PATH) {
+        outputWrite(output, NO_PATH, sizeof(NO_PATH) - 1);
+    }
+    else {
+        outputWriteInt(output, hops);
+        outputWrite(output, "\n", 1);
+    }
+    outputEndReply(output);
+}
+
+
+
+/******* RING FUNCTIONS *******/
+
+static Ring* ringInit (INTEGER size) {
+    Ring *ring = malloc(sizeof(Ring));
+    ring->data = malloc(size * sizeof(INTEGER));
+    ring->size = size;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return ring;
+}
+
+static void ringFree (Ring *ring) {
+    free(ring->data);
+    free(ring);
+}
+
+static INTEGER ringLength (Ring *ring) {
+    return atomic_load_explicit(&ring->head, memory_order_acquire) - atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+static void ringWrite (Ring *ring, INTEGER *values, INTEGER count) {
+    // single producer: only this thread moves the head
+    INTEGER head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    while (ring->size - (head - atomic_load_explicit(&ring->tail, memory_order_acquire)) < count) {
+        sched_yield();
+    }
+    for (INTEGER idx = 0; idx < count; idx++) {
+        ring->data[(head + idx) & (ring->size - 1)] = values[idx];
+    }
+    atomic_store_explicit(&ring->head, head + count, memory_order_release);
+}
+
+static INTEGER ringRead (Ring *ring) {
+    // single consumer: only this thread moves the tail
+    INTEGER tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (atomic_load_explicit(&ring->head, memory_order_acquire) == tail) {
+        sched_yield();
+    }
+    INTEGER value = ring->data[tail & (ring->size - 1)];
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return value;
+}
+
+
+
+/******* INPUT FUNCTIONS *******/
+
+static Input* inputInit (INTEGER size) {
+    Input *input = malloc(sizeof(Input));
+    input->data = malloc(size * sizeof(char));
+    input->size = size;
+    input->used = 0;
+    input->position = 0;
+    input->mark = 0;
+    input->finished = false;
+    input->binary = false;
+    input->commands = NULL;
+    input->staged = NULL;
+    input->stagedUsed = 0;
+    input->error = NULL;
+    input->queued = NULL;
+    return input;
+}
+
+static Input* inputInitQueue (INTEGER size) {
+    // the commands are queued by another input, and stdin is never read
+    Input *input = inputInit(0);
+    input->queued = malloc(size * sizeof(INTEGER));
+    input->queuedSize = size;
+    input->queuedUsed = 0;
+    input->queuedPosition = 0;
+    return input;
+}
+
+static void inputFree (Input *input) {
+    if (input->commands != NULL) {
+        pthread_join(input->parser, NULL);
+        ringFree(input->commands);
+        free(input->staged);
+    }
+    free(input->queued);
+    free(input->data);
+    free(input);
+}
+
+static void inputRefill (Input *input) {
+    // bytes from the mark on belong to the token being read and are kept
+    INTEGER kept = input->used - input->mark;
+    memmove(input->data, input->data + input->mark, kept);
+    input->position -= input->mark;
+    input->used = kept;
+    input->mark = 0;
+    ssize_t bytes = read(STDIN_FILENO, input->data + input->used, input->size - input->used);
+    if (bytes <= 0) {
+        input->finished = true;
+    } else {
+        input->used += bytes;
+    }
+}
+
+static bool inputHasData (Input *input) {
+    if (input->position == input->used && !input->finished) {
+        inputRefill(input);
+    }
+    return input->position < input->used;
+}
+
+static bool inputSkipSpaces (Input *input) {
+    input->mark = input->position;
+    while (inputHasData(input)) {
+        if (input->data[input->position] > ' ') {
+            return true;
+        }
+        input->position++;
+        input->mark = input->position;
+    }
+    return false;
+}
+
+static char* inputReadToken (Input *input, INTEGER *length) {
+    if (!inputSkipSpaces(input)) {
+        return NULL;
+    }
+    while (inputHasData(input) && input->data[input->position] > ' ') {
+        input->position++;
+    }
+    *length = input->position - input->mark;
+    return input->data + input->mark;
+}
+
+static INTEGER inputParseInt (Input *input) {
+    INTEGER value = 0;
+    char *data;
+    if (input->binary) {
+        return inputParseBinaryInt(input);
+    }
+    if (!inputSkipSpaces(input) || !isDigit(input->data[input->position])) {
+        return inputFail(input, "unable to read integer");
+    }
+    while (inputHasData(input)) {
+        data = input->data;
+        while (input->position < input->used && isDigit(data[input->position])) {
+            value = 10 * value + (data[input->position++] - '0');
+        }
+        if (input->position < input->used) {
+            break;
+        }
+        input->mark = input->position;
+    }
+    return value;
+}
+
+static int inputParseCommand (Input *input) {
+    INTEGER length;
+    char *token, *expected = NULL;
+    int command = UNKNOWN_COMMAND;
+    if (input->binary) {
+        return inputParseBinaryCommand(input);
+    }
+    token = inputReadToken(input, &length);
+    if (token == NULL) {
+        return EOF;
+    }
+    // a number before a command is its highway, left to be read as an integer
+    if (isDigit(token[0])) {
+        input->position = input->mark;
+        return HIGHWAY_COMMAND;
+    }
+    // the commands differ in length except for two, which differ in the first letter
+    if (length == sizeof(ADD_STATION) - 1) {
+        expected = ADD_STATION;
+        command = ADD_STATION_COMMAND;
+    }
+    else if (length == sizeof(ADD_CAR) - 1) {
+        expected = ADD_CAR;
+        command = ADD_CAR_COMMAND;
+    }
+    else if (length == sizeof(DEL_CAR) - 1) {
+        expected = DEL_CAR;
+        command = DEL_CAR_COMMAND;
+    }
+    else if (length == sizeof(DEL_STATION) - 1 && token[0] == DEL_STATION[0]) {
+        expected = DEL_STATION;
+        command = DEL_STATION_COMMAND;
+    }
+    else if (length == sizeof(FIND_PATH) - 1 && token[0] == FIND_PATH[0]) {
+        expected = FIND_PATH;
+        command = FIND_PATH_COMMAND;
+    }
+    else if (length == sizeof(COUNT_STOPS) - 1) {
+        expected = COUNT_STOPS;
+        command = COUNT_STOPS_COMMAND;
+    }
+    else if (length == sizeof(SUBSCRIBE) - 1) {
+        expected = SUBSCRIBE;
+        command = SUBSCRIBE_COMMAND;
+    }
+    else if (length == sizeof(UNSUBSCRIBE) - 1) {
+        expected = UNSUBSCRIBE;
+        command = UNSUBSCRIBE_COMMAND;
+    }
+    if (expected == NULL || memcmp(token, expected, length) != 0) {
+        return UNKNOWN_COMMAND;
+    }
+    return command;
+}
+
+// binary commands are their code as a byte followed by their integers,
+// each one as BINARY_INTEGER_SIZE little endian bytes
+
+static INTEGER inputParseBinaryInt (Input *input) {
+    unsigned long value = 0;
+    unsigned char *data;
+    input->mark = input->position;
+    while (input->used - input->position < BINARY_INTEGER_SIZE && !input->finished) {
+        inputRefill(input);
+    }
+    if (input->used - input->position < BINARY_INTEGER_SIZE) {
+        return inputFail(input, "unable to read integer");
+    }
+    data = (unsigned char*) input->data + input->position;
+    for (INTEGER byteIdx = BINARY_INTEGER_SIZE - 1; byteIdx >= 0; byteIdx--) {
+        value = value << 8 | data[byteIdx];
+    }
+    input->position += BINARY_INTEGER_SIZE;
+    // the text protocol only has digits, so a negative value is read as BINARY_REFUSED,
+    // which every command refuses as it would a missing station
+    return (INTEGER) value < 0 ? BINARY_REFUSED : (INTEGER) value;
+}
+
+static int inputParseBinaryCommand (Input *input) {
+    input->mark = input->position;
+    if (!inputHasData(input)) {
+        return EOF;
+    }
+    int command = (unsigned char) input->data[input->position++];
+    if (command < ADD_STATION_COMMAND || command > UNSUBSCRIBE_COMMAND) {
+        return UNKNOWN_COMMAND;
+    }
+    return command;
+}
+
+static INTEGER inputFail (Input *input, char *message) {
+    // the parser thread leaves the error to the executor, which raises it
+    // after answering the commands parsed before
+    if (input->commands == NULL) {
+        raiseCustomError(message);
+    }
+    if (input->error == NULL) {
+        input->error = message;
+    }
+    return -1;
+}
+
+
+
+static INTEGER inputReadInt (Input *input) {
+    if (input->queued != NULL) {
+        return input->queued[input->queuedPosition++];
+    }
+    if (input->commands != NULL) {
+        return ringRead(input->commands);
+    }
+    return inputParseInt(input);
+}
+
+static int inputReadCommand (Input *input) {
+    if (input->queued != NULL) {
+        return input->queuedPosition < input->queuedUsed ? input->queued[input->queuedPosition++] : EOF;
+    }
+    if (input->commands != NULL) {
+        return ringRead(input->commands);
+    }
+    return inputParseCommand(input);
+}
+
+static void inputStartParser (Input *input) {
+    input->commands = ringInit(RING_SIZE);
+    input->staged = malloc(RING_CHUNK * sizeof(INTEGER));
+    input->stagedSize = RING_CHUNK;
+    input->stagedUsed = 0;
+    pthread_create(&input->parser, NULL, inputRunParser, input);
+}
+
+static void* inputRunParser (void *data) {
+    Input *input = data;
+    INTEGER counter;
+    int command;
+    // commands are passed on as their code followed by their integers, and a
+    // command that fails to parse is replaced by an unknown one carrying the error
+    while (true) {
+        command = inputParseCommand(input);
+        inputStage(input, command);
+        if (command == ADD_STATION_COMMAND) {
+            inputStage(input, inputParseInt(input));
+            counter = inputParseInt(input);
+            inputStage(input, counter);
+            for (INTEGER i = 1; i <= counter && input->error == NULL; i++) {
+                inputStage(input, inputParseInt(input));
+            }
+        }
+        else if (command == DEL_STATION_COMMAND || command == HIGHWAY_COMMAND) {
+            inputStage(input, inputParseInt(input));
+        }
+        else if (command == ADD_CAR_COMMAND || command == DEL_CAR_COMMAND || command == FIND_PATH_COMMAND || command == COUNT_STOPS_COMMAND || command == SUBSCRIBE_COMMAND || command == UNSUBSCRIBE_COMMAND) {
+            inputStage(input, inputParseInt(input));
+            inputStage(input, inputParseInt(input));
+        }
+        else {
+            inputPublish(input);
+            return NULL;
+        }
+        if (input->error != NULL) {
+            input->stagedUsed = 0;
+            inputStage(input, UNKNOWN_COMMAND);
+            inputPublish(input);
+            return NULL;
+        }
+        inputPublish(input);
+    }
+}
+
+static void inputStage (Input *input, INTEGER value) {
+    // a command is staged whole, so that it can still be dropped if it fails to parse
+    if (input->stagedUsed == input->stagedSize) {
+        input->stagedSize *= VECTOR_SIZE_MULTIPLIER;
+        input->staged = realloc(input->staged, input->stagedSize * sizeof(INTEGER));
+    }
+    input->staged[input->stagedUsed++] = value;
+}
+
+static void inputPublish (Input *input) {
+    INTEGER count;
+    for (INTEGER idx = 0; idx < input->stagedUsed; idx += count) {
+        count = input->stagedUsed - idx < RING_CHUNK ? input->stagedUsed - idx : RING_CHUNK;
+        ringWrite(input->commands, input->staged + idx, count);
+    }
+    input->stagedUsed = 0;
+}
+
+static void inputQueue (Input *input, INTEGER value) {
+    if (input->queuedUsed == input->queuedSize) {
+        input->queuedSize *= VECTOR_SIZE_MULTIPLIER;
+        input->queued = realloc(input->queued, input->queuedSize * sizeof(INTEGER));
+    }
+    input->queued[input->queuedUsed++] = value;
+}
+
+static void inputClearQueue (Input *input) {
+    input->queuedUsed = 0;
+    input->queuedPosition = 0;
+}
+
+
+
+/******* OUTPUT FUNCTIONS *******/
+
+static Output* outputInit (INTEGER size) {
+    Output *output = malloc(sizeof(Output));
+    output->data = malloc(size * sizeof(char));
+    output->size = size;
+    output->used = 0;
+    output->binary = false;
+    output->blocks = NULL;
+    output->ends = NULL;
+    return output;
+}
+
+static Output* outputInitReplies (INTEGER size) {
+    // replies are kept, and the end of each one recorded, until they are merged
+    Output *output = outputInit(size);
+    output->ends = malloc(size * sizeof(INTEGER));
+    output->endsSize = size;
+    output->endsUsed = 0;
+    return output;
+}
+
+static void outputFree (Output *output) {
+    if (output->ends != NULL) {
+        free(output->ends);
+        free(output->data);
+        free(output);
+        return;
+    }
+    outputFlush(output);
+    if (output->blocks != NULL) {
+        INTEGER stop = -1;
+        ringWrite(output->filled, &stop, 1);
+        pthread_join(output->writer, NULL);
+        for (INTEGER blockIdx = 0; blockIdx < OUTPUT_BLOCKS; blockIdx++) {
+            free(output->blocks[blockIdx]);
+        }
+        free(output->blocks);
+        ringFree(output->filled);
+        ringFree(output->released);
+    } else {
+        free(output->data);
+    }
+    free(output);
+}
+
+static void outputWriteData (char *data, INTEGER length) {
+    INTEGER written = 0;
+    ssize_t bytes;
+    while (written < length) {
+        bytes = write(STDOUT_FILENO, data + written, length - written);
+        if (bytes <= 0) {
+            break;
+        }
+        written += bytes;
+    }
+}
+
+static void outputSwap (Output *output) {
+    if (output->blocks == NULL) {
+        outputWriteData(output->data, output->used);
+        output->used = 0;
+        return;
+    }
+    // the full block goes to the writer, and the next free one takes its place
+    INTEGER block[2] = {output->blockIdx, output->used};
+    ringWrite(output->filled, block, 2);
+    output->blockIdx = ringRead(output->released);
+    output->data = output->blocks[output->blockIdx];
+    output->used = 0;
+}
+
+static void outputFlush (Output *output) {
+    outputSwap(output);
+    if (output->blocks == NULL) {
+        return;
+    }
+    while (ringLength(output->released) < OUTPUT_BLOCKS - 1) {
+        sched_yield();
+    }
+}
+
+static void outputStartWriter (Output *output) {
+    output->blocks = malloc(OUTPUT_BLOCKS * sizeof(char*));
+    output->blocks[0] = output->data;
+    output->blockIdx = 0;
+    output->filled = ringInit(RING_CHUNK);
+    output->released = ringInit(RING_CHUNK);
+    for (INTEGER blockIdx = 1; blockIdx < OUTPUT_BLOCKS; blockIdx++) {
+        output->blocks[blockIdx] = malloc(output->size * sizeof(char));
+        ringWrite(output->released, &blockIdx, 1);
+    }
+    pthread_create(&output->writer, NULL, outputRunWriter, output);
+}
+
+static void* outputRunWriter (void *data) {
+    Output *output = data;
+    INTEGER blockIdx, length;
+    while ((blockIdx = ringRead(output->filled)) >= 0) {
+        length = ringRead(output->filled);
+        outputWriteData(output->blocks[blockIdx], length);
+        ringWrite(output->released, &blockIdx, 1);
+    }
+    return NULL;
+}
+
+static void outputWrite (Output *output, char *string, INTEGER length) {
+    if (output->used + length > output->size && output->ends != NULL) {
+        while (output->used + length > output->size) {
+            output->size *= OUTPUT_SIZE_MULTIPLIER;
+        }
+        output->data = realloc(output->data, output->size * sizeof(char));
+    }
+    else if (output->used + length > output->size) {
+        outputSwap(output);
+        if (length > output->size) {
+            outputFlush(output);
+            outputWriteData(string, length);
+            return;
+        }
+    }
+    memcpy(output->data + output->used, string, length);
+    output->used += length;
+}
+
+static void outputWriteInt (Output *output, INTEGER value) {
+    char digits[INTEGER_DIGITS + 1];
+    char *digit = digits + sizeof(digits);
+    unsigned long magnitude = value < 0 ? -(unsigned long) value : (unsigned long) value;
+    do {
+        *--digit = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (value < 0) {
+        *--digit = '-';
+    }
+    outputWrite(output, digit, digits + sizeof(digits) - digit);
+}
+
+static void outputWriteBinaryInt (Output *output, INTEGER value) {
+    char bytes[BINARY_INTEGER_SIZE];
+    unsigned long bits = (unsigned long) value;
+    for (INTEGER byteIdx = 0; byteIdx < BINARY_INTEGER_SIZE; byteIdx++) {
+        bytes[byteIdx] = (char) (bits & 0xFF);
+        bits >>= 8;
+    }
+    outputWrite(output, bytes, BINARY_INTEGER_SIZE);
+}
+
+static void outputEndReply (Output *output) {
+    if (output->ends == NULL) {
+        return;
+    }
+    if (output->endsUsed == output->endsSize) {
+        output->endsSize *= OUTPUT_SIZE_MULTIPLIER;
+        output->ends = realloc(output->ends, output->endsSize * sizeof(INTEGER));
+    }
+    output->ends[output->endsUsed++] = output->used;
+}
+
+static void outputClearReplies (Output *output) {
+    output->used = 0;
+    output->endsUsed = 0;
+}
+
+#endif
+
+
+
+/******* POOL FUNCTIONS *******/
+
+static Pool* poolInit (INTEGER itemSize) {
+    Pool *pool = malloc(sizeof(Pool));
+    pool->chunks = NULL;
+    pool->freeList = NULL;
+    pool->itemSize = itemSize;
+    pool->chunkSize = 0;
+    pool->chunkUsed = 0;
+    pool->allocated = 0;
+    return pool;
+}
+
+static void poolFree (Pool *pool) {
+    PoolChunk *chunk = pool->chunks, *temp;
+    while (chunk != NULL) {
+        temp = chunk->next;
+        free(chunk);
+        chunk = temp;
+    }
+    free(pool);
+}
+
+static void* poolAlloc (Pool *pool) {
+    void *item = pool->freeList;
+    INTEGER size;
+    if (item != NULL) {
+        pool->freeList = *(void**) item;
+        return item;
+    }
+    // chunks double up to POOL_MAX_SIZE items, so small tables stay small
+    if (pool->chunks == NULL || pool->chunkUsed == pool->chunkSize) {
+        size = POOL_SIZE_MULTIPLIER * pool->chunkSize;
+        size = size < POOL_INITIAL_SIZE ? POOL_INITIAL_SIZE : size > POOL_MAX_SIZE ? POOL_MAX_SIZE : size;
+        PoolChunk *chunk = malloc(sizeof(PoolChunk) + size * pool->itemSize);
+        chunk->next = pool->chunks;
+        pool->chunks = chunk;
+        pool->chunkSize = size;
+        pool->chunkUsed = 0;
+        pool->allocated += size;
+    }
+    item = (char*) (pool->chunks + 1) + pool->chunkUsed * pool->itemSize;
+    pool->chunkUsed++;
+    return item;
+}
+
+static void poolRelease (Pool *pool, void *item) {
+    *(void**) item = pool->freeList;
+    pool->freeList = item;
+}
+
+
+
+/******* SET FUNCTIONS *******/
+
+static Set* setInit (INTEGER size) {
+    Set *set = malloc(sizeof(Set));
+    set->data = malloc(size * sizeof(SetNode));
+    set->size = size;
+    set->used = 0;
+    for (INTEGER bucketIdx = 0; bucketIdx < size; bucketIdx++) {
+        set->data[bucketIdx].key = EMPTY_KEY;
+    }
+    return set;
+};
+
+static INTEGER setBucketIdx (Set *set, INTEGER key) {
+    return ((unsigned long) key * HT_HASH_MULTIPLIER >> 32) & (set->size - 1);
+}
+
+static INTEGER setProbeDist (Set *set, INTEGER idx) {
+    return (idx - setBucketIdx(set, set->data[idx].key)) & (set->size - 1);
+}
+
+static void setIter (INTEGER *iterator) {
+    *iterator = -1;
+}
+
+static SetNode* setNext (Set *set, INTEGER *iterator) {
+    if (set == NULL) {
+        return NULL;
+    }
+    while (*iterator < set->size) {
+        (*iterator)++;
+        if (*iterator < set->size && set->data[*iterator].key != EMPTY_KEY) {
+            return set->data + *iterator;
+        }
+    }
+    return NULL;
+}
+
+static void setFree (Set *set) {
+    if (set == NULL) {
+        return;
+    }
+    free(set->data);
+    free(set);
+}
+
+static bool setShouldResize (Set *set) {
+    return set->used >= HT_LOAD_FACTOR * set->size;
+}
+
+static bool setShouldShrink (Set *set) {
+    return set->size > HT_INITIAL_SIZE && set->used < HT_SHRINK_FACTOR * set->size;
+}
+
+static void setResize (Set *set, INTEGER size) {
+    if (stats != NULL) {
+        statsCount(size > set->size ? &stats->setResizes : &stats->setShrinks);
+    }
+    Set *tempHt = setInit(size);
+    INTEGER iterator;
+    setIter(&iterator);
+    for (SetNode *node = setNext(set, &iterator); node; node = setNext(set, &iterator)) {
+        setInsertNode(tempHt, *node);
+    }
+    free(set->data);
+    set->data = tempHt->data;
+    set->size = tempHt->size;
+    set->used = tempHt->used;
+    free(tempHt);
+};
+
+static SetNode* setSearch (Set *set, INTEGER key) {
+    INTEGER idx = setBucketIdx(set, key);
+    // robin hood ordering: a slot closer to its bucket than the probe means the key is missing
+    INTEGER dist = 0;
+    for (; set->data[idx].key != EMPTY_KEY && setProbeDist(set, idx) >= dist; dist++) {
+        if (set->data[idx].key == key) {
+            break;
+        }
+        idx = (idx + 1) & (set->size - 1);
+    }
+    if (stats != NULL) {
+        statsRecord(&stats->setProbes, dist);
+    }
+    return set->data[idx].key == key ? set->data + idx : NULL;
+};
+
+static bool setInsert (Set *set, INTEGER key) {
+    SetNode *node = setSearch(set, key);
+    if (node != NULL) {
+        node->count++;
+        return false;
+    }
+    if (setShouldResize(set)) {
+        setResize(set, HT_SIZE_MULTIPLIER * set->size);
+    }
+    setInsertNode(set, (SetNode) {key, 1});
+    return true;
+}
+
+static void setInsertNode (Set *set, SetNode node) {
+    INTEGER idx = setBucketIdx(set, node.key), dist = 0, slotDist;
+    SetNode temp;
+    while (set->data[idx].key != EMPTY_KEY) {
+        slotDist = setProbeDist(set, idx);
+        if (slotDist < dist) {
+            temp = set->data[idx];
+            set->data[idx] = node;
+            node = temp;
+            dist = slotDist;
+        }
+        idx = (idx + 1) & (set->size - 1);
+        dist++;
+    }
+    set->data[idx] = node;
+    set->used++;
+}
+
+static bool setDelete (Set *set, INTEGER key) {
+    SetNode *node = setSearch(set, key);
+    if (node == NULL) {
+        return false;
+    }
+    if (node->count > 1) {
+        node->count--;
+        return true;
+    }
+    INTEGER idx = node - set->data;
+    INTEGER nextIdx = (idx + 1) & (set->size - 1);
+    while (set->data[nextIdx].key != EMPTY_KEY && setProbeDist(set, nextIdx) > 0) {
+        set->data[idx] = set->data[nextIdx];
+        idx = nextIdx;
+        nextIdx = (nextIdx + 1) & (set->size - 1);
+    }
+    set->data[idx].key = EMPTY_KEY;
+    set->used--;
+    if (setShouldShrink(set)) {
+        setResize(set, set->size / HT_SIZE_MULTIPLIER);
+    }
+    return true;
+};
+
+static INTEGER setBytes (Set *set) {
+    return set != NULL ? sizeof(Set) + set->size * sizeof(SetNode) : 0;
+}
+
+static INTEGER setSlack (Set *set) {
+    // buckets beyond the smallest table that would hold the same cars
+    INTEGER size = HT_INITIAL_SIZE;
+    if (set == NULL) {
+        return 0;
+    }
+    while (set->used > HT_LOAD_FACTOR * size) {
+        size *= HT_SIZE_MULTIPLIER;
+    }
+    return (set->size - size) * sizeof(SetNode);
+}
+
+
+
+/******* HASH TABLE FUNCTIONS *******/
+
+static HashTable* htInit (INTEGER size) {
+    HashTable *ht = malloc(sizeof(HashTable));
+    ht->data = malloc(size * sizeof(HTNode*));
+    ht->nodes = poolInit(sizeof(HTNode));
+    ht->size = size;
+    ht->used = 0;
+    for (INTEGER bucketIdx = 0; bucketIdx < size; bucketIdx++) {
+        ht->data[bucketIdx] = NULL;
+    }
+    return ht;
+};
+
+static INTEGER htBucketIdx (HashTable *ht, INTEGER key) {
+    return ((unsigned long) key * HT_HASH_MULTIPLIER >> 32) & (ht->size - 1);
+}
+
+static HTNode* htNext (HashTable *ht, HTNode *node) {
     INTEGER bucketIdx;
-    if (set->iterator == NULL) {
-        bucketIdx = 0;
+    if (ht == NULL) {
+        return NULL;
+    }
+    if (node != NULL && node->next != NULL) {
+        return node->next;
+    }
+    bucketIdx = node == NULL ? 0 : htBucketIdx(ht, node->key) + 1;
+    for (; bucketIdx < ht->size; bucketIdx++) {
+        if (ht->data[bucketIdx] != NULL) {
+            return ht->data[bucketIdx];
+        }
+    }
+    return NULL;
+}
+
+static void htFree (HashTable *ht) {
+    if (ht == NULL) {
+        return;
+    }
+    for (HTNode *node = htNext(ht, NULL); node; node = htNext(ht, node)) {
+        setFree(node->value);
+        heapFree(node->maxHeap);
+    }
+    poolFree(ht->nodes);
+    free(ht->data);
+    free(ht);
+}
+
+static bool htShouldResize (HashTable *ht) {
+    return ht->used >= HT_LOAD_FACTOR * ht->size;
+}
+
+static bool htShouldShrink (HashTable *ht) {
+    return ht->size > HT_INITIAL_SIZE && ht->used < HT_SHRINK_FACTOR * ht->size;
+}
+
+static void htResize (HashTable *ht, INTEGER size) {
+    HTNode **data = ht->data, *node, *next;
+    INTEGER oldSize = ht->size, bucketIdx;
+    if (stats != NULL) {
+        statsCount(size > ht->size ? &stats->htResizes : &stats->htShrinks);
+    }
+    // the nodes are relinked into the new buckets, and keep their addresses
+    ht->data = malloc(size * sizeof(HTNode*));
+    ht->size = size;
+    for (bucketIdx = 0; bucketIdx < size; bucketIdx++) {
+        ht->data[bucketIdx] = NULL;
+    }
+    for (INTEGER oldIdx = 0; oldIdx < oldSize; oldIdx++) {
+        for (node = data[oldIdx]; node != NULL; node = next) {
+            next = node->next;
+            bucketIdx = htBucketIdx(ht, node->key);
+            node->next = ht->data[bucketIdx];
+            ht->data[bucketIdx] = node;
+        }
+    }
+    free(data);
+};
+
+static HTNode* htSearch (HashTable *ht, INTEGER key) {
+    HTNode *node = ht->data[htBucketIdx(ht, key)];
+    INTEGER dist = 0;
+    for (; node != NULL && node->key != key; dist++) {
+        node = node->next;
+    }
+    if (stats != NULL) {
+        statsRecord(&stats->htProbes, dist);
+    }
+    return node;
+};
+
+static void htInsert (HashTable *ht, INTEGER key) {
+    HTNode *node = htSearch(ht, key);
+    if (node != NULL) {
+        return;
+    }
+    if (htShouldResize(ht)) {
+        htResize(ht, HT_SIZE_MULTIPLIER * ht->size);
+    }
+    htInsertNode(ht, (HTNode) {key, NULL, NULL, NULL});
+}
+
+static void htInsertNode (HashTable *ht, HTNode node) {
+    HTNode *slot = poolAlloc(ht->nodes);
+    INTEGER bucketIdx = htBucketIdx(ht, node.key);
+    *slot = node;
+    slot->next = ht->data[bucketIdx];
+    ht->data[bucketIdx] = slot;
+    ht->used++;
+}
+
+static bool htDelete (HashTable *ht, INTEGER key) {
+    HTNode **link = ht->data + htBucketIdx(ht, key), *node;
+    INTEGER dist = 0;
+    for (; *link != NULL && (*link)->key != key; dist++) {
+        link = &(*link)->next;
+    }
+    if (stats != NULL) {
+        statsRecord(&stats->htProbes, dist);
+    }
+    node = *link;
+    if (node == NULL) {
+        return false;
+    }
+    *link = node->next;
+    setFree(node->value);
+    heapFree(node->maxHeap);
+    poolRelease(ht->nodes, node);
+    ht->used--;
+    if (htShouldShrink(ht)) {
+        htResize(ht, ht->size / HT_SIZE_MULTIPLIER);
+    }
+    return true;
+};
+
+static INTEGER htBytes (HashTable *ht) {
+    return sizeof(HashTable) + ht->size * sizeof(HTNode*) + sizeof(Pool) + ht->nodes->allocated * sizeof(HTNode);
+}
+
+static INTEGER htSlack (HashTable *ht) {
+    // buckets beyond the smallest table that would hold the same stations,
+    // and pooled nodes left free by demolitions
+    INTEGER size = HT_INITIAL_SIZE;
+    while (ht->used > HT_LOAD_FACTOR * size) {
+        size *= HT_SIZE_MULTIPLIER;
+    }
+    return (ht->size - size) * sizeof(HTNode*) + (ht->nodes->allocated - ht->used) * sizeof(HTNode);
+}
+
+
+
+/******* VECTOR FUNCTIONS *******/
+
+static Vector* vectorInit (INTEGER size) {
+    Vector *v = malloc(sizeof(Vector));
+    v->stations = malloc(size * sizeof(KEY));
+    v->cars = malloc(size * sizeof(KEY));
+    v->size = size;
+    v->used = 0;
+    return v;
+}
+static void vectorFree (Vector *v) {
+    free(v->stations);
+    free(v->cars);
+    free(v);
+}
+static void vectorResize (Vector *v) {
+    INTEGER newSize = VECTOR_SIZE_MULTIPLIER * v->size;
+    v->stations = realloc(v->stations, newSize * sizeof(KEY));
+    v->cars = realloc(v->cars, newSize * sizeof(KEY));
+    v->size = newSize;
+}
+static void vectorShrink (Vector *v) {
+    INTEGER newSize = v->size / VECTOR_SIZE_MULTIPLIER;
+    v->stations = realloc(v->stations, newSize * sizeof(KEY));
+    v->cars = realloc(v->cars, newSize * sizeof(KEY));
+    v->size = newSize;
+}
+static INTEGER vectorLength (Vector *v) {
+    return v->used;
+}
+static INTEGER vectorGetStation (Vector *v, INTEGER idx) {
+#ifndef NDEBUG
+    if (idx < 0 || idx > vectorLength(v)) {
+        raiseCustomError("invalid index (get)");
+        return -1;
+    }
+#endif
+    return v->stations[idx];
+}
+static INTEGER vectorGetCar (Vector *v, INTEGER idx) {
+#ifndef NDEBUG
+    if (idx < 0 || idx > vectorLength(v)) {
+        raiseCustomError("invalid index (get)");
+        return -1;
+    }
+#endif
+    return v->cars[idx];
+}
+static void vectorSet (Vector *v, INTEGER idx, INTEGER station, INTEGER car) {
+#ifndef NDEBUG
+    if (idx < 0 || idx > vectorLength(v)) {
+        raiseCustomError("invalid index (set)");
+        return;
+    }
+#endif
+    if (vectorLength(v) == v->size) {
+        vectorResize(v);
+    }
+    v->stations[idx] = station;
+    v->cars[idx] = car;
+    if (idx == vectorLength(v)) {
+        v->used++;
+    }
+}
+static void vectorPush (Vector *v, INTEGER station, INTEGER car) {
+    vectorSet(v, vectorLength(v), station, car);
+}
+static void vectorInsert (Vector *v, INTEGER idx, INTEGER station, INTEGER car) {
+#ifndef NDEBUG
+    if (idx < 0 || idx > vectorLength(v)) {
+        raiseCustomError("invalid index (insert)");
+        return;
+    }
+#endif
+    if (vectorLength(v) == v->size) {
+        vectorResize(v);
+    }
+    memmove(v->stations + idx + 1, v->stations + idx, (vectorLength(v) - idx) * sizeof(KEY));
+    memmove(v->cars + idx + 1, v->cars + idx, (vectorLength(v) - idx) * sizeof(KEY));
+    v->stations[idx] = station;
+    v->cars[idx] = car;
+    v->used++;
+}
+static void vectorDelete (Vector *v, INTEGER idx) {
+#ifndef NDEBUG
+    if (idx < 0 || idx >= vectorLength(v)) {
+        raiseCustomError("invalid index (delete)");
+        return;
+    }
+#endif
+    memmove(v->stations + idx, v->stations + idx + 1, (vectorLength(v) - idx - 1) * sizeof(KEY));
+    memmove(v->cars + idx, v->cars + idx + 1, (vectorLength(v) - idx - 1) * sizeof(KEY));
+    v->used--;
+    if (v->size > VECTOR_INITIAL_SIZE && v->used < VECTOR_SHRINK_FACTOR * v->size) {
+        vectorShrink(v);
+    }
+}
+static INTEGER vectorFindStation (Vector *v, INTEGER station) {
+    INTEGER idx = vectorLowerBound(v, station);
+    if (idx == vectorLength(v) || v->stations[idx] != station) {
+        raiseCustomError("unable to find vector idx");
+        return -1;
+    }
+    return idx;
+}
+static INTEGER vectorLowerBound (Vector *v, INTEGER station) {
+    INTEGER low = 0, high = vectorLength(v), mid;
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (v->stations[mid] < station) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+static INTEGER vectorLastAtMost (Vector *v, INTEGER fromIdx, INTEGER toIdx, INTEGER station) {
+    INTEGER low = fromIdx - 1, high = fromIdx, step = 1, mid;
+    // galloping from fromIdx, so that a short answer costs a few steps;
+    // returns fromIdx - 1 when no station in range is close enough
+    while (high <= toIdx && v->stations[high] <= station) {
+        low = high;
+        high = fromIdx + 2 * step - 1;
+        step *= 2;
+    }
+    high = high <= toIdx ? high : toIdx + 1;
+    while (high - low > 1) {
+        mid = low + (high - low) / 2;
+        if (v->stations[mid] <= station) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+static INTEGER vectorFirstAtLeast (Vector *v, INTEGER fromIdx, INTEGER toIdx, INTEGER station) {
+    INTEGER low = fromIdx, high = fromIdx + 1, step = 1, mid;
+    // same galloping walking backwards, returns fromIdx + 1 when no station qualifies
+    while (low >= toIdx && v->stations[low] >= station) {
+        high = low;
+        low = fromIdx - 2 * step + 1;
+        step *= 2;
+    }
+    low = low >= toIdx ? low : toIdx - 1;
+    while (high - low > 1) {
+        mid = low + (high - low) / 2;
+        if (v->stations[mid] >= station) {
+            high = mid;
+        } else {
+            low = mid;
+        }
+    }
+    return high;
+}
+static void vectorCopy (Vector *dest, Vector *src) {
+    while (dest->size < vectorLength(src)) {
+        vectorResize(dest);
+    }
+    memcpy(dest->stations, src->stations, vectorLength(src) * sizeof(KEY));
+    memcpy(dest->cars, src->cars, vectorLength(src) * sizeof(KEY));
+    dest->used = vectorLength(src);
+}
+static void vectorTruncate (Vector *v, INTEGER length) {
+#ifndef NDEBUG
+    if (length < 0 || length > vectorLength(v)) {
+        raiseCustomError("invalid length (truncate)");
+        return;
+    }
+#endif
+    v->used = length;
+}
+
+static INTEGER vectorBytes (Vector *v) {
+    return sizeof(Vector) + 2 * v->size * sizeof(KEY);
+}
+
+static INTEGER vectorSlack (Vector *v) {
+    return 2 * (v->size - v->used) * sizeof(KEY);
+}
+
+
+
+/******* HEAP FUNCTIONS *******/
+
+static Heap* heapInit (INTEGER size) {
+    Heap *heap = malloc(sizeof(Heap));
+    heap->data = malloc(size * sizeof(KEY));
+    heap->size = size;
+    heap->used = 0;
+    return heap;
+}
+static void heapFree (Heap *heap) {
+    if (heap == NULL) {
+        return;
+    }
+    free(heap->data);
+    free(heap);
+}
+static void heapResize (Heap *heap) {
+    INTEGER newSize = HEAP_SIZE_MULTIPLIER * heap->size;
+    heap->data = realloc(heap->data, newSize * sizeof(KEY));
+    heap->size = newSize;
+}
+static INTEGER heapLength (Heap *heap) {
+    return heap->used;
+}
+static INTEGER heapTop (Heap *heap) {
+    if (heapLength(heap) == 0) {
+        raiseCustomError("empty heap (top)");
+        return -1;
+    }
+    return heap->data[0];
+}
+static void heapPush (Heap *heap, INTEGER key) {
+    if (heapLength(heap) == heap->size) {
+        heapResize(heap);
+    }
+    INTEGER idx = heap->used++, parentIdx;
+    while (idx > 0) {
+        parentIdx = (idx - 1) / 2;
+        if (heap->data[parentIdx] >= key) {
+            break;
+        }
+        heap->data[idx] = heap->data[parentIdx];
+        idx = parentIdx;
+    }
+    heap->data[idx] = key;
+}
+static void heapPop (Heap *heap) {
+    if (heapLength(heap) == 0) {
+        raiseCustomError("empty heap (pop)");
+        return;
+    }
+    INTEGER key = heap->data[--heap->used];
+    INTEGER idx = 0, childIdx;
+    while ((childIdx = 2 * idx + 1) < heap->used) {
+        if (childIdx + 1 < heap->used && heap->data[childIdx + 1] > heap->data[childIdx]) {
+            childIdx++;
+        }
+        if (key >= heap->data[childIdx]) {
+            break;
+        }
+        heap->data[idx] = heap->data[childIdx];
+        idx = childIdx;
+    }
+    heap->data[idx] = key;
+}
+static void heapClear (Heap *heap) {
+    heap->used = 0;
+}
+
+static INTEGER heapBytes (Heap *heap) {
+    return heap != NULL ? sizeof(Heap) + heap->size * sizeof(KEY) : 0;
+}
+
+
+
+/******* CACHE FUNCTIONS *******/
+
+static Cache* cacheInit (INTEGER size) {
+    Cache *cache = malloc(sizeof(Cache));
+    cache->entries = malloc(size * sizeof(CacheEntry));
+    cache->data = malloc(size * sizeof(CacheEntry*));
+    cache->log = malloc(CACHE_LOG_SIZE * sizeof(INTEGER));
+    cache->size = size;
+    cache->used = 0;
+    cache->hand = 0;
+    cache->epoch = 0;
+    cache->observed = false;
+    for (INTEGER bucketIdx = 0; bucketIdx < size; bucketIdx++) {
+        cache->data[bucketIdx] = NULL;
+    }
+    cache->log[0] = -1;
+    return cache;
+}
+
+static void cacheFree (Cache *cache) {
+    for (INTEGER entryIdx = 0; entryIdx < cache->used; entryIdx++) {
+        vectorFree(cache->entries[entryIdx].path);
+    }
+    free(cache->entries);
+    free(cache->data);
+    free(cache->log);
+    free(cache);
+}
+
+static INTEGER cacheBucketIdx (Cache *cache, INTEGER start, INTEGER end) {
+    return (unsigned long) (start * 31 + end) % cache->size;
+}
+
+static CacheEntry* cacheSearch (Cache *cache, INTEGER start, INTEGER end) {
+    CacheEntry *entry = cache->data[cacheBucketIdx(cache, start, end)];
+    while (entry != NULL && (entry->start != start || entry->end != end)) {
+        entry = entry->next;
+    }
+    return entry;
+}
+
+static bool cacheIsValid (Cache *cache, CacheEntry *entry) {
+    if (cache->epoch - entry->epoch >= CACHE_LOG_SIZE) {
+        return false;
+    }
+    INTEGER low = entry->start < entry->end ? entry->start : entry->end;
+    INTEGER high = entry->start < entry->end ? entry->end : entry->start;
+    INTEGER station;
+    // only the stations between start and end can change the path
+    for (INTEGER epoch = entry->epoch + 1; epoch <= cache->epoch; epoch++) {
+        station = cache->log[epoch % CACHE_LOG_SIZE];
+        if (station >= low && station <= high) {
+            return false;
+        }
+    }
+    entry->epoch = cache->epoch;
+    cache->observed = true;
+    return true;
+}
+
+static CacheEntry* cacheEvict (Cache *cache) {
+    CacheEntry *entry;
+    if (cache->used < cache->size) {
+        entry = cache->entries + cache->used++;
+        entry->path = vectorInit(VECTOR_INITIAL_SIZE);
+        return entry;
+    }
+    entry = cache->entries + cache->hand;
+    while (entry->referenced) {
+        entry->referenced = false;
+        cache->hand = (cache->hand + 1) % cache->size;
+        entry = cache->entries + cache->hand;
+    }
+    cache->hand = (cache->hand + 1) % cache->size;
+    CacheEntry **bucket = cache->data + cacheBucketIdx(cache, entry->start, entry->end);
+    while (*bucket != entry) {
+        bucket = &(*bucket)->next;
+    }
+    *bucket = entry->next;
+    return entry;
+}
+
+static void cacheInsert (Cache *cache, INTEGER start, INTEGER end, bool exists, Vector *path) {
+    CacheEntry *entry = cacheSearch(cache, start, end);
+    if (entry == NULL) {
+        entry = cacheEvict(cache);
+        entry->start = start;
+        entry->end = end;
+        CacheEntry **bucket = cache->data + cacheBucketIdx(cache, start, end);
+        entry->next = *bucket;
+        *bucket = entry;
+    }
+    entry->epoch = cache->epoch;
+    cache->observed = true;
+    entry->exists = exists;
+    entry->referenced = false;
+    vectorCopy(entry->path, path);
+}
+
+static void cacheInvalidate (Cache *cache, INTEGER station) {
+    // repeated changes to a station are logged once until some entry is stored for the epoch
+    if (!cache->observed && cache->log[cache->epoch % CACHE_LOG_SIZE] == station) {
+        return;
+    }
+    cache->epoch++;
+    cache->observed = false;
+    cache->log[cache->epoch % CACHE_LOG_SIZE] = station;
+}
+
+static INTEGER cacheBytes (Cache *cache) {
+    INTEGER bytes = sizeof(Cache) + cache->size * (sizeof(CacheEntry) + sizeof(CacheEntry*)) + CACHE_LOG_SIZE * sizeof(INTEGER);
+    for (INTEGER entryIdx = 0; entryIdx < cache->used; entryIdx++) {
+        bytes += vectorBytes(cache->entries[entryIdx].path);
+    }
+    return bytes;
+}
+
+
+
+/******* SCAN FUNCTIONS *******/
+
+// stations and best cars are kept in separate arrays so that these scans load
+// four (AVX2) or two (SSE4.2) consecutive stations at once; the scalar loops
+// finish the ranges and are the whole scan on other targets
+
+static INTEGER scanMaxSum (KEY *stations, KEY *cars, INTEGER firstIdx, INTEGER lastIdx) {
+    INTEGER result = TREE_EMPTY_HIGH, idx = firstIdx;
+#if defined(__AVX2__)
+    INTEGER lanes[4];
+    __m256i best = _mm256_set1_epi64x(TREE_EMPTY_HIGH), sum;
+    for (; idx + 3 <= lastIdx; idx += 4) {
+        sum = _mm256_add_epi64(SCAN_LOAD_FOUR(stations + idx), SCAN_LOAD_FOUR(cars + idx));
+        best = _mm256_blendv_epi8(best, sum, _mm256_cmpgt_epi64(sum, best));
+    }
+    _mm256_storeu_si256((__m256i*) lanes, best);
+    for (INTEGER lane = 0; lane < 4; lane++) {
+        result = lanes[lane] > result ? lanes[lane] : result;
+    }
+#elif defined(__SSE4_2__)
+    INTEGER lanes[2];
+    __m128i best = _mm_set1_epi64x(TREE_EMPTY_HIGH), sum;
+    for (; idx + 1 <= lastIdx; idx += 2) {
+        sum = _mm_add_epi64(SCAN_LOAD_TWO(stations + idx), SCAN_LOAD_TWO(cars + idx));
+        best = _mm_blendv_epi8(best, sum, _mm_cmpgt_epi64(sum, best));
+    }
+    _mm_storeu_si128((__m128i*) lanes, best);
+    result = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+#endif
+    for (; idx <= lastIdx; idx++) {
+        result = (INTEGER) stations[idx] + cars[idx] > result ? (INTEGER) stations[idx] + cars[idx] : result;
+    }
+    return result;
+}
+
+static INTEGER scanMinDifference (KEY *stations, KEY *cars, INTEGER firstIdx, INTEGER lastIdx) {
+    INTEGER result = TREE_EMPTY_LOW, idx = firstIdx;
+#if defined(__AVX2__)
+    INTEGER lanes[4];
+    __m256i best = _mm256_set1_epi64x(TREE_EMPTY_LOW), difference;
+    for (; idx + 3 <= lastIdx; idx += 4) {
+        difference = _mm256_sub_epi64(SCAN_LOAD_FOUR(stations + idx), SCAN_LOAD_FOUR(cars + idx));
+        best = _mm256_blendv_epi8(best, difference, _mm256_cmpgt_epi64(best, difference));
+    }
+    _mm256_storeu_si256((__m256i*) lanes, best);
+    for (INTEGER lane = 0; lane < 4; lane++) {
+        result = lanes[lane] < result ? lanes[lane] : result;
+    }
+#elif defined(__SSE4_2__)
+    INTEGER lanes[2];
+    __m128i best = _mm_set1_epi64x(TREE_EMPTY_LOW), difference;
+    for (; idx + 1 <= lastIdx; idx += 2) {
+        difference = _mm_sub_epi64(SCAN_LOAD_TWO(stations + idx), SCAN_LOAD_TWO(cars + idx));
+        best = _mm_blendv_epi8(best, difference, _mm_cmpgt_epi64(best, difference));
+    }
+    _mm_storeu_si128((__m128i*) lanes, best);
+    result = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+#endif
+    for (; idx <= lastIdx; idx++) {
+        result = (INTEGER) stations[idx] - cars[idx] < result ? (INTEGER) stations[idx] - cars[idx] : result;
+    }
+    return result;
+}
+
+static INTEGER scanFirstSumAtLeast (KEY *stations, KEY *cars, INTEGER firstIdx, INTEGER lastIdx, INTEGER station) {
+    // returns lastIdx + 1 when no station in range reaches the given one
+    INTEGER idx = firstIdx;
+#if defined(__AVX2__)
+    int mask;
+    __m256i limit = _mm256_set1_epi64x(station - 1), sum;
+    for (; idx + 3 <= lastIdx; idx += 4) {
+        sum = _mm256_add_epi64(SCAN_LOAD_FOUR(stations + idx), SCAN_LOAD_FOUR(cars + idx));
+        mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(sum, limit)));
+        if (mask != 0) {
+            return idx + __builtin_ctz(mask);
+        }
+    }
+#elif defined(__SSE4_2__)
+    int mask;
+    __m128i limit = _mm_set1_epi64x(station - 1), sum;
+    for (; idx + 1 <= lastIdx; idx += 2) {
+        sum = _mm_add_epi64(SCAN_LOAD_TWO(stations + idx), SCAN_LOAD_TWO(cars + idx));
+        mask = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(sum, limit)));
+        if (mask != 0) {
+            return idx + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; idx <= lastIdx; idx++) {
+        if ((INTEGER) stations[idx] + cars[idx] >= station) {
+            return idx;
+        }
+    }
+    return idx;
+}
+
+static INTEGER scanFirstDifferenceAtMost (KEY *stations, KEY *cars, INTEGER firstIdx, INTEGER lastIdx, INTEGER station) {
+    INTEGER idx = firstIdx;
+#if defined(__AVX2__)
+    int mask;
+    __m256i limit = _mm256_set1_epi64x(station + 1), difference;
+    for (; idx + 3 <= lastIdx; idx += 4) {
+        difference = _mm256_sub_epi64(SCAN_LOAD_FOUR(stations + idx), SCAN_LOAD_FOUR(cars + idx));
+        mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(limit, difference)));
+        if (mask != 0) {
+            return idx + __builtin_ctz(mask);
+        }
+    }
+#elif defined(__SSE4_2__)
+    int mask;
+    __m128i limit = _mm_set1_epi64x(station + 1), difference;
+    for (; idx + 1 <= lastIdx; idx += 2) {
+        difference = _mm_sub_epi64(SCAN_LOAD_TWO(stations + idx), SCAN_LOAD_TWO(cars + idx));
+        mask = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(limit, difference)));
+        if (mask != 0) {
+            return idx + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; idx <= lastIdx; idx++) {
+        if ((INTEGER) stations[idx] - cars[idx] <= station) {
+            return idx;
+        }
+    }
+    return idx;
+}
+
+
+
+/******* JUMP FUNCTIONS *******/
+
+static Jump* jumpInit () {
+    Jump *jump = malloc(sizeof(Jump));
+    jump->forward = NULL;
+    jump->backward = NULL;
+    jump->forwardReach = NULL;
+    jump->backwardReach = NULL;
+    jump->stack = NULL;
+    jump->size = 0;
+    jump->used = 0;
+    jump->levels = 0;
+    jump->dirtyLow = 0;
+    jump->dirtyHigh = -1;
+    jump->reshaped = false;
+    jump->layers = vectorInit(VECTOR_INITIAL_SIZE);
+    jump->swept = 0;
+    return jump;
+}
+
+static void jumpFree (Jump *jump) {
+    free(jump->forward);
+    free(jump->backward);
+    free(jump->forwardReach);
+    free(jump->backwardReach);
+    free(jump->stack);
+    vectorFree(jump->layers);
+    free(jump);
+}
+
+static void jumpResize (Jump *jump, INTEGER size) {
+    jump->levels = 1;
+    while ((1l << jump->levels) < size) {
+        jump->levels++;
+    }
+    jump->size = size;
+    jump->forward = realloc(jump->forward, jump->levels * size * sizeof(KEY));
+    jump->backward = realloc(jump->backward, jump->levels * size * sizeof(KEY));
+    jump->forwardReach = realloc(jump->forwardReach, size * sizeof(KEY));
+    jump->backwardReach = realloc(jump->backwardReach, size * sizeof(KEY));
+    jump->stack = realloc(jump->stack, size * sizeof(KEY));
+}
+
+static bool jumpIsClean (Jump *jump) {
+    return !jump->reshaped && jump->dirtyLow > jump->dirtyHigh;
+}
+
+static void jumpMarkCar (Jump *jump, INTEGER idx) {
+    jump->swept = 0;
+    if (jumpIsClean(jump)) {
+        jump->dirtyLow = idx;
+        jump->dirtyHigh = idx;
+        return;
+    }
+    jump->dirtyLow = idx < jump->dirtyLow ? idx : jump->dirtyLow;
+    jump->dirtyHigh = idx > jump->dirtyHigh ? idx : jump->dirtyHigh;
+}
+
+static void jumpMarkStations (Jump *jump) {
+    jump->swept = 0;
+    jump->reshaped = true;
+}
+
+static void jumpUpdate (Jump *jump, Vector *bestCars) {
+    if (jumpIsClean(jump)) {
+        return;
+    }
+    // forward hops only look at the stations after them and backward hops at the ones
+    // before, so a car change leaves the tables valid past the changed stations
+    if (jump->reshaped) {
+        // the tables are rebuilt whole after a reshape, so they grow to the exact count
+        // of stations instead of keeping room for more, which would cost every level
+        if (vectorLength(bestCars) > jump->size) {
+            jumpResize(jump, vectorLength(bestCars));
+        }
+        jump->used = vectorLength(bestCars);
+        jump->dirtyLow = 0;
+        jump->dirtyHigh = jump->used - 1;
+    }
+    if (jump->used > 0) {
+        jumpBuildForward(jump, bestCars, jump->dirtyHigh);
+        jumpBuildBackward(jump, bestCars, jump->dirtyLow);
+    }
+    jump->reshaped = false;
+    jump->dirtyLow = jump->used;
+    jump->dirtyHigh = -1;
+}
+
+static void jumpBuildForward (Jump *jump, Vector *bestCars, INTEGER lastIdx) {
+    KEY *stations = bestCars->stations, *cars = bestCars->cars;
+    KEY *reach = jump->forwardReach, *stack = jump->stack, *level;
+    INTEGER stackUsed = 0, low, high, mid;
+
+    for (INTEGER idx = lastIdx; idx >= 0; idx--) {
+        low = idx;
+        high = jump->used - 1;
+        while (low < high) {
+            mid = (low + high + 1) / 2;
+            if (stations[mid] - stations[idx] <= cars[idx]) {
+                low = mid;
+            } else {
+                high = mid - 1;
+            }
+        }
+        reach[idx] = low;
+    }
+
+    // the first hop goes to the station in range that reaches farthest: the stack keeps,
+    // from the bottom, the stations not outreached by a closer one
+    for (INTEGER idx = jump->used - 1; idx >= 0; idx--) {
+        while (stackUsed > 0 && reach[stack[stackUsed - 1]] <= reach[idx]) {
+            stackUsed--;
+        }
+        stack[stackUsed++] = idx;
+        if (idx > lastIdx) {
+            continue;
+        }
+        low = 0;
+        high = stackUsed - 1;
+        while (low < high) {
+            mid = (low + high) / 2;
+            if (stack[mid] <= reach[idx]) {
+                high = mid;
+            } else {
+                low = mid + 1;
+            }
+        }
+        jump->forward[idx] = stack[low];
+    }
+
+    for (INTEGER levelIdx = 1; levelIdx < jump->levels; levelIdx++) {
+        level = jump->forward + levelIdx * jump->size;
+        for (INTEGER idx = 0; idx <= lastIdx; idx++) {
+            level[idx] = level[-jump->size + level[-jump->size + idx]];
+        }
+    }
+}
+
+static void jumpBuildBackward (Jump *jump, Vector *bestCars, INTEGER firstIdx) {
+    KEY *stations = bestCars->stations, *cars = bestCars->cars;
+    KEY *reach = jump->backwardReach, *stack = jump->stack, *level;
+    INTEGER stackUsed = 0, low, high, mid;
+
+    for (INTEGER idx = firstIdx; idx < jump->used; idx++) {
+        low = 0;
+        high = idx;
+        while (low < high) {
+            mid = (low + high) / 2;
+            if (stations[idx] - stations[mid] <= cars[idx]) {
+                high = mid;
+            } else {
+                low = mid + 1;
+            }
+        }
+        reach[idx] = low;
+    }
+
+    for (INTEGER idx = 0; idx < jump->used; idx++) {
+        while (stackUsed > 0 && reach[stack[stackUsed - 1]] >= reach[idx]) {
+            stackUsed--;
+        }
+        stack[stackUsed++] = idx;
+        if (idx < firstIdx) {
+            continue;
+        }
+        low = 0;
+        high = stackUsed - 1;
+        while (low < high) {
+            mid = (low + high) / 2;
+            if (stack[mid] >= reach[idx]) {
+                high = mid;
+            } else {
+                low = mid + 1;
+            }
+        }
+        jump->backward[idx] = stack[low];
+    }
+
+    for (INTEGER levelIdx = 1; levelIdx < jump->levels; levelIdx++) {
+        level = jump->backward + levelIdx * jump->size;
+        for (INTEGER idx = firstIdx; idx < jump->used; idx++) {
+            level[idx] = level[-jump->size + level[-jump->size + idx]];
+        }
+    }
+}
+
+static INTEGER jumpCountHops (Jump *jump, INTEGER startIdx, INTEGER endIdx) {
+    bool straight = startIdx < endIdx;
+    KEY *reach = straight ? jump->forwardReach : jump->backwardReach;
+    KEY *table = straight ? jump->forward : jump->backward;
+    INTEGER currIdx = startIdx, nextIdx, hops = 1;
+    if (startIdx == endIdx) {
+        return 0;
+    }
+
+    // after k hops from the start the farthest station reached is the reach of
+    // the k-th jump, so the count is found by lifting while the end stays out of reach
+    for (INTEGER levelIdx = jump->levels - 1; levelIdx >= 0; levelIdx--) {
+        if (straight ? reach[currIdx] >= endIdx : reach[currIdx] <= endIdx) {
+            return hops;
+        }
+        nextIdx = table[levelIdx * jump->size + currIdx];
+        if (straight ? reach[nextIdx] < endIdx : reach[nextIdx] > endIdx) {
+            currIdx = nextIdx;
+            hops += 1l << levelIdx;
+        }
+    }
+    if (straight ? reach[currIdx] >= endIdx : reach[currIdx] <= endIdx) {
+        return hops;
+    }
+    nextIdx = table[currIdx];
+    if (straight ? reach[nextIdx] >= endIdx : reach[nextIdx] <= endIdx) {
+        return hops + 1;
+    }
+    return -1;
+}
+
+static INTEGER jumpBytes (Jump *jump) {
+    return sizeof(Jump) + (2 * jump->levels + 3) * jump->size * sizeof(KEY) + vectorBytes(jump->layers);
+}
+
+
+
+/******* TREE FUNCTIONS *******/
+
+static Tree* treeInit () {
+    Tree *tree = malloc(sizeof(Tree));
+    tree->high = NULL;
+    tree->low = NULL;
+    tree->size = 0;
+    tree->used = 0;
+    tree->dirty = true;
+    return tree;
+}
+
+static void treeFree (Tree *tree) {
+    free(tree->high);
+    free(tree->low);
+    free(tree);
+}
+
+static void treeBuild (Tree *tree, Vector *bestCars) {
+    INTEGER size = 1;
+    while (size < vectorLength(bestCars)) {
+        size *= 2;
+    }
+    if (size != tree->size) {
+        tree->size = size;
+        tree->high = realloc(tree->high, 2 * size * sizeof(INTEGER));
+        tree->low = realloc(tree->low, 2 * size * sizeof(INTEGER));
+    }
+    // the leaves hold station + best car and station - best car in station order,
+    // each inner node the max and the min of its children
+    for (INTEGER idx = 0; idx < size; idx++) {
+        if (idx < vectorLength(bestCars)) {
+            tree->high[size + idx] = vectorGetStation(bestCars, idx) + vectorGetCar(bestCars, idx);
+            tree->low[size + idx] = vectorGetStation(bestCars, idx) - vectorGetCar(bestCars, idx);
+        } else {
+            tree->high[size + idx] = TREE_EMPTY_HIGH;
+            tree->low[size + idx] = TREE_EMPTY_LOW;
+        }
+    }
+    for (INTEGER idx = size - 1; idx > 0; idx--) {
+        tree->high[idx] = tree->high[2 * idx] > tree->high[2 * idx + 1] ? tree->high[2 * idx] : tree->high[2 * idx + 1];
+        tree->low[idx] = tree->low[2 * idx] < tree->low[2 * idx + 1] ? tree->low[2 * idx] : tree->low[2 * idx + 1];
+    }
+    tree->used = vectorLength(bestCars);
+    tree->dirty = false;
+}
+
+static void treeUpdate (Tree *tree, INTEGER idx, INTEGER station, INTEGER car) {
+    // a dirty tree is rebuilt before the next plan anyway
+    if (tree->dirty) {
+        return;
+    }
+    idx += tree->size;
+    tree->high[idx] = station + car;
+    tree->low[idx] = station - car;
+    for (idx /= 2; idx > 0; idx /= 2) {
+        tree->high[idx] = tree->high[2 * idx] > tree->high[2 * idx + 1] ? tree->high[2 * idx] : tree->high[2 * idx + 1];
+        tree->low[idx] = tree->low[2 * idx] < tree->low[2 * idx + 1] ? tree->low[2 * idx] : tree->low[2 * idx + 1];
+    }
+}
+
+static void treeInsert (Tree *tree, INTEGER idx, INTEGER station, INTEGER car) {
+    // the leaves after the new station move one slot right, like the station index,
+    // and only the nodes above them are recomputed; a full tree is rebuilt larger
+    if (tree->dirty || tree->used == tree->size) {
+        tree->dirty = true;
+        return;
+    }
+    memmove(tree->high + tree->size + idx + 1, tree->high + tree->size + idx, (tree->used - idx) * sizeof(INTEGER));
+    memmove(tree->low + tree->size + idx + 1, tree->low + tree->size + idx, (tree->used - idx) * sizeof(INTEGER));
+    tree->high[tree->size + idx] = station + car;
+    tree->low[tree->size + idx] = station - car;
+    tree->used++;
+    treeRefresh(tree, idx, tree->used - 1);
+}
+
+static void treeDelete (Tree *tree, INTEGER idx) {
+    if (tree->dirty) {
+        return;
+    }
+    memmove(tree->high + tree->size + idx, tree->high + tree->size + idx + 1, (tree->used - idx - 1) * sizeof(INTEGER));
+    memmove(tree->low + tree->size + idx, tree->low + tree->size + idx + 1, (tree->used - idx - 1) * sizeof(INTEGER));
+    tree->used--;
+    tree->high[tree->size + tree->used] = TREE_EMPTY_HIGH;
+    tree->low[tree->size + tree->used] = TREE_EMPTY_LOW;
+    treeRefresh(tree, idx, tree->used);
+}
+
+static void treeRefresh (Tree *tree, INTEGER firstIdx, INTEGER lastIdx) {
+    // recompute, level by level, the inner nodes above the leaves from firstIdx to lastIdx
+    for (firstIdx = (firstIdx + tree->size) / 2, lastIdx = (lastIdx + tree->size) / 2; firstIdx > 0; firstIdx /= 2, lastIdx /= 2) {
+        for (INTEGER idx = firstIdx; idx <= lastIdx; idx++) {
+            tree->high[idx] = tree->high[2 * idx] > tree->high[2 * idx + 1] ? tree->high[2 * idx] : tree->high[2 * idx + 1];
+            tree->low[idx] = tree->low[2 * idx] < tree->low[2 * idx + 1] ? tree->low[2 * idx] : tree->low[2 * idx + 1];
+        }
+    }
+}
+
+static INTEGER treeMaxHigh (Tree *tree, INTEGER firstIdx, INTEGER lastIdx) {
+    INTEGER result = TREE_EMPTY_HIGH;
+    for (firstIdx += tree->size, lastIdx += tree->size + 1; firstIdx < lastIdx; firstIdx /= 2, lastIdx /= 2) {
+        if (firstIdx & 1) {
+            result = tree->high[firstIdx] > result ? tree->high[firstIdx] : result;
+            firstIdx++;
+        }
+        if (lastIdx & 1) {
+            lastIdx--;
+            result = tree->high[lastIdx] > result ? tree->high[lastIdx] : result;
+        }
+    }
+    return result;
+}
+
+static INTEGER treeMinLow (Tree *tree, INTEGER firstIdx, INTEGER lastIdx) {
+    INTEGER result = TREE_EMPTY_LOW;
+    for (firstIdx += tree->size, lastIdx += tree->size + 1; firstIdx < lastIdx; firstIdx /= 2, lastIdx /= 2) {
+        if (firstIdx & 1) {
+            result = tree->low[firstIdx] < result ? tree->low[firstIdx] : result;
+            firstIdx++;
+        }
+        if (lastIdx & 1) {
+            lastIdx--;
+            result = tree->low[lastIdx] < result ? tree->low[lastIdx] : result;
+        }
+    }
+    return result;
+}
+
+static INTEGER treeFirstHigh (Tree *tree, INTEGER fromIdx, INTEGER station) {
+    INTEGER idx = fromIdx + tree->size;
+    // climb to the next subtree on the right until one reaches the station, then descend into it
+    while (tree->high[idx] < station) {
+        while (idx & 1) {
+            idx /= 2;
+        }
+        if (idx == 0) {
+            return -1;
+        }
+        idx++;
+    }
+    while (idx < tree->size) {
+        idx = tree->high[2 * idx] >= station ? 2 * idx : 2 * idx + 1;
+    }
+    return idx - tree->size;
+}
+
+static INTEGER treeFirstLow (Tree *tree, INTEGER fromIdx, INTEGER station) {
+    INTEGER idx = fromIdx + tree->size;
+    while (tree->low[idx] > station) {
+        while (idx & 1) {
+            idx /= 2;
+        }
+        if (idx == 0) {
+            return -1;
+        }
+        idx++;
+    }
+    while (idx < tree->size) {
+        idx = tree->low[2 * idx] <= station ? 2 * idx : 2 * idx + 1;
+    }
+    return idx - tree->size;
+}
+
+static INTEGER treeBytes (Tree *tree) {
+    return sizeof(Tree) + 4 * tree->size * sizeof(INTEGER);
+}
+
+
+
+/******* BATCH FUNCTIONS *******/
+
+static Batch* batchInit (INTEGER size, INTEGER workersUsed) {
+    Batch *batch = malloc(sizeof(Batch));
+    batch->queries = malloc(size * sizeof(Query));
+    batch->tasks = malloc(size * sizeof(INTEGER));
+    batch->workers = malloc(workersUsed * sizeof(Worker));
+    batch->size = size;
+    batch->used = 0;
+    batch->tasksUsed = 0;
+    batch->workersUsed = workersUsed;
+    batch->bestCars = NULL;
+    batch->tree = NULL;
+    batch->stopped = false;
+    for (INTEGER workerIdx = 0; workerIdx < workersUsed; workerIdx++) {
+        Worker *worker = batch->workers + workerIdx;
+        worker->batch = batch;
+        worker->id = workerIdx;
+        worker->layers = vectorInit(VECTOR_INITIAL_SIZE);
+        worker->path = vectorInit(VECTOR_INITIAL_SIZE);
+        worker->results = vectorInit(VECTOR_INITIAL_SIZE);
+    }
+    // the main thread acts as the first worker
+    if (workersUsed > 1) {
+        pthread_barrier_init(&batch->barrier, NULL, workersUsed);
+        for (INTEGER workerIdx = 1; workerIdx < workersUsed; workerIdx++) {
+            pthread_create(&batch->workers[workerIdx].thread, NULL, workerRun, batch->workers + workerIdx);
+        }
+    }
+    return batch;
+}
+
+static void batchFree (Batch *batch) {
+    if (batch->workersUsed > 1) {
+        batch->stopped = true;
+        pthread_barrier_wait(&batch->barrier);
+        for (INTEGER workerIdx = 1; workerIdx < batch->workersUsed; workerIdx++) {
+            pthread_join(batch->workers[workerIdx].thread, NULL);
+        }
+        pthread_barrier_destroy(&batch->barrier);
+    }
+    for (INTEGER workerIdx = 0; workerIdx < batch->workersUsed; workerIdx++) {
+        vectorFree(batch->workers[workerIdx].layers);
+        vectorFree(batch->workers[workerIdx].path);
+        vectorFree(batch->workers[workerIdx].results);
+    }
+    free(batch->workers);
+    free(batch->tasks);
+    free(batch->queries);
+    free(batch);
+}
+
+static bool batchIsFull (Batch *batch) {
+    return batch->used == batch->size;
+}
+
+static void batchPush (Batch *batch, INTEGER start, INTEGER end) {
+    Query *query = batch->queries + batch->used;
+    query->start = start;
+    query->end = end;
+    query->position = batch->used;
+    batch->used++;
+}
+
+static int batchCompareByInterval (const void *data1, const void *data2) {
+    Query *query1 = (Query*) data1;
+    Query *query2 = (Query*) data2;
+    INTEGER dist1 = labs(query1->end - query1->start);
+    INTEGER dist2 = labs(query2->end - query2->start);
+    if (query1->start != query2->start) {
+        return query1->start < query2->start ? -1 : 1;
+    }
+    if ((query1->start < query1->end) != (query2->start < query2->end)) {
+        return query1->start < query1->end ? -1 : 1;
+    }
+    if (dist1 != dist2) {
+        return dist1 < dist2 ? -1 : 1;
+    }
+    return 0;
+}
+
+static int batchCompareByPosition (const void *data1, const void *data2) {
+    Query *query1 = (Query*) data1;
+    Query *query2 = (Query*) data2;
+    if (query1->position != query2->position) {
+        return query1->position < query2->position ? -1 : 1;
+    }
+    return 0;
+}
+
+static bool batchSameGroup (Query *query1, Query *query2) {
+    return query1->start == query2->start && (query1->start < query1->end) == (query2->start < query2->end);
+}
+
+static void batchSaveResult (Worker *worker, Query *query) {
+    query->worker = worker->id;
+    query->offset = vectorLength(worker->results);
+    query->length = vectorLength(worker->path);
+    for (INTEGER pathIdx = 0; pathIdx < vectorLength(worker->path); pathIdx++) {
+        vectorPush(worker->results, vectorGetStation(worker->path, pathIdx), UNDEFINED);
+    }
+}
+
+static void batchPlanGroup (Batch *batch, Worker *worker, INTEGER firstIdx) {
+    Vector *bestCars = batch->bestCars;
+    Query *first = batch->queries + firstIdx, *query;
+    bool straight = first->start < first->end;
+    INTEGER lastIdx = firstIdx, layerIdx = 0, endIdx;
+
+    // queries leaving the same station in the same direction share the layers,
+    // computed once up to the farthest end and then walked by increasing distance
+    while (lastIdx + 1 < batch->used && batchSameGroup(first, batch->queries + lastIdx + 1)) {
+        lastIdx++;
+    }
+    while (!batch->queries[lastIdx].planned) {
+        lastIdx--;
+    }
+    vectorTruncate(worker->layers, 0);
+    vectorPush(worker->layers, first->start, vectorFindStation(bestCars, first->start));
+    endIdx = vectorFindStation(bestCars, batch->queries[lastIdx].end);
+    if (straight) {
+        getStraightLayers(bestCars, batch->tree, endIdx, worker->layers);
     } else {
-        bucketIdx = setBucketIdx(set, set->iterator->key) + 1;
+        getReversedLayers(bestCars, batch->tree, endIdx, worker->layers);
     }
-    for (; bucketIdx < set->size; bucketIdx++) {
-        next = set->data[bucketIdx];
-        if (next != NULL) {
-            set->iterator = next;
-            return set->iterator;
+
+    for (INTEGER queryIdx = firstIdx; queryIdx <= lastIdx; queryIdx++) {
+        query = batch->queries + queryIdx;
+        if (!query->planned) {
+            continue;
         }
+        endIdx = vectorFindStation(bestCars, query->end);
+        while (layerIdx < vectorLength(worker->layers) && (straight ? vectorGetCar(worker->layers, layerIdx) < endIdx : vectorGetCar(worker->layers, layerIdx) > endIdx)) {
+            layerIdx++;
+        }
+        vectorTruncate(worker->path, 0);
+        query->exists = layerIdx < vectorLength(worker->layers);
+        if (query->exists) {
+            vectorCopy(worker->path, worker->layers);
+            vectorTruncate(worker->path, layerIdx + 1);
+            if (straight) {
+                getStraightStops(bestCars, batch->tree, endIdx, worker->path);
+            } else {
+                getReversedStops(bestCars, batch->tree, endIdx, worker->path);
+            }
+        }
+        batchSaveResult(worker, query);
     }
-    set->iterator = NULL;
-    set->iterationFinished = true;
-    return NULL;
 }
 
-void setFree (Set *set) {
-    if (set == NULL) {
+static void batchAnswer (Batch *batch, Planner *planner, PathReply reply, void *context) {
+    if (batch->used == 0) {
         return;
     }
-    setIter(set);
-    SetNode *node = setNext(set);
-    SetNode *temp = NULL;
-    while (node != NULL) {
-        temp = setNext(set);
-        free(node);
-        node = temp;
+    Vector *bestCars = planner->bestCars;
+    Cache *cache = planner->cache;
+    Jump *jump = planner->jump;
+    Tree *tree = planner->tree;
+    Worker *mainWorker = batch->workers;
+    Query *query;
+    CacheEntry *entry;
+    INTEGER begin = stats != NULL ? statsClock() : 0;
+    // the jump tables reject unreachable ends without a scan, but only when they
+    // are already up to date: paths never pay for rebuilding them
+    bool rejects = jumpIsClean(jump);
+
+    // cache lookups and trivial trips are answered by the main thread, the rest is split
+    // by groups among the workers while the stations cannot change
+    qsort(batch->queries, batch->used, sizeof(Query), batchCompareByInterval);
+    for (INTEGER workerIdx = 0; workerIdx < batch->workersUsed; workerIdx++) {
+        vectorTruncate(batch->workers[workerIdx].results, 0);
+    }
+    batch->bestCars = bestCars;
+    batch->tree = tree;
+    if (tree->dirty) {
+        treeBuild(tree, bestCars);
+    }
+    batch->tasksUsed = 0;
+    for (INTEGER queryIdx = 0; queryIdx < batch->used; queryIdx++) {
+        query = batch->queries + queryIdx;
+        query->planned = false;
+        vectorTruncate(mainWorker->path, 0);
+        entry = cacheSearch(cache, query->start, query->end);
+        if (entry != NULL && cacheIsValid(cache, entry)) {
+            entry->referenced = true;
+            if (stats != NULL) {
+                statsCount(&stats->cacheHits);
+            }
+            vectorCopy(mainWorker->path, entry->path);
+            query->exists = entry->exists;
+            batchSaveResult(mainWorker, query);
+        }
+        else if (!isKey(query->start) || !isKey(query->end) || htSearch(planner->stations, query->start) == NULL || htSearch(planner->stations, query->end) == NULL) {
+            query->exists = false;
+            batchSaveResult(mainWorker, query);
+        }
+        else if (query->start == query->end) {
+            query->exists = getPath(bestCars, tree, query->start, query->end, mainWorker->path);
+            batchSaveResult(mainWorker, query);
+        }
+        else if (rejects && jumpCountHops(jump, vectorFindStation(bestCars, query->start), vectorFindStation(bestCars, query->end)) < 0) {
+            query->exists = false;
+            batchSaveResult(mainWorker, query);
+        }
+        else {
+            query->planned = true;
+            if (stats != NULL) {
+                statsCount(&stats->cacheMisses);
+            }
+            if (batch->tasksUsed == 0 || !batchSameGroup(batch->queries + batch->tasks[batch->tasksUsed - 1], query)) {
+                batch->tasks[batch->tasksUsed++] = queryIdx;
+            }
+        }
     }
-    free(set->data);
-    free(set);
-}
 
-bool setShouldResize (Set *set) {
-    if (set->size >= HT_MAX_SIZE) {
-        return false;
+    atomic_store(&batch->nextTask, 0);
+    if (batch->workersUsed > 1 && batch->tasksUsed > 1) {
+        pthread_barrier_wait(&batch->barrier);
+        workerPlan(mainWorker);
+        pthread_barrier_wait(&batch->barrier);
+    } else {
+        workerPlan(mainWorker);
     }
-    return set->used >= HT_LOAD_FACTOR * set->size;
-}
 
-void setResize (Set *set) {
-    Set *tempHt = setInit(HT_SIZE_MULTIPLIER * set->size);
-    setIter(set);
-    SetNode *node = setNext(set);
-    SetNode *temp = NULL;
-    while (node != NULL) {
-        temp = setNext(set);
-        setInsertNode(tempHt, node);
-        node = temp;
+    qsort(batch->queries, batch->used, sizeof(Query), batchCompareByPosition);
+    for (INTEGER queryIdx = 0; queryIdx < batch->used; queryIdx++) {
+        query = batch->queries + queryIdx;
+        Vector *results = batch->workers[query->worker].results;
+        if (query->planned) {
+            vectorTruncate(mainWorker->path, 0);
+            for (INTEGER pathIdx = query->offset; pathIdx < query->offset + query->length; pathIdx++) {
+                vectorPush(mainWorker->path, vectorGetStation(results, pathIdx), UNDEFINED);
+            }
+            cacheInsert(cache, query->start, query->end, query->exists, mainWorker->path);
+        }
+        reply(context, results->stations + query->offset, query->exists ? query->length : PLANNER_NO_PATH);
     }
-    free(set->data);
-    set->data = tempHt->data;
-    set->size = tempHt->size;
-    set->used = tempHt->used;
-    free(tempHt);
-};
+    // each query is charged an equal share of its batch
+    if (stats != NULL) {
+        INTEGER elapsed = statsClock() - begin;
+        statsRecord(&stats->batches, elapsed);
+        for (INTEGER queryIdx = 0; queryIdx < batch->used; queryIdx++) {
+            statsRecord(stats->commands + FIND_PATH_COMMAND, elapsed / batch->used);
+        }
+    }
+    batch->used = 0;
+}
 
-SetNode* setSearch (Set *set, INTEGER key, SetNode **deleteHelper) {
-    SetNode *prev = NULL;
-    SetNode *node = *setBucket(set, key);
-    while (node != NULL && node->key != key) {
-        prev = node;
-        node = node->next;
+static INTEGER batchBytes (Batch *batch) {
+    INTEGER bytes = sizeof(Batch) + batch->size * (sizeof(Query) + sizeof(INTEGER)) + batch->workersUsed * sizeof(Worker);
+    for (INTEGER workerIdx = 0; workerIdx < batch->workersUsed; workerIdx++) {
+        bytes += vectorBytes(batch->workers[workerIdx].layers);
+        bytes += vectorBytes(batch->workers[workerIdx].path);
+        bytes += vectorBytes(batch->workers[workerIdx].results);
     }
-    if (deleteHelper != NULL) {
-        *deleteHelper = prev;
+    return bytes;
+}
+
+
+
+/******* WORKER FUNCTIONS *******/
+
+static void* workerRun (void *data) {
+    Worker *worker = data;
+    Batch *batch = worker->batch;
+    while (true) {
+        pthread_barrier_wait(&batch->barrier);
+        if (batch->stopped) {
+            return NULL;
+        }
+        workerPlan(worker);
+        pthread_barrier_wait(&batch->barrier);
     }
-    return node;
-};
+}
 
-void setInsert (Set *set, INTEGER key) {
-    SetNode *node = setSearch(set, key, NULL);
-    if (node != NULL) {
-        return;
+static void workerPlan (Worker *worker) {
+    Batch *batch = worker->batch;
+    INTEGER task;
+    while ((task = atomic_fetch_add(&batch->nextTask, 1)) < batch->tasksUsed) {
+        batchPlanGroup(batch, worker, batch->tasks[task]);
     }
-    node = malloc(sizeof(SetNode));
-    node->key = key;
-    node->next = NULL;
-    if (setShouldResize(set)) {
-        setResize(set);
+}
+
+
+
+/******* SUBSCRIPTION FUNCTIONS *******/
+
+// subscriptions are kept sorted by their lower end, then by their higher end
+// and their start; a tree over them holds the highest end of each range, so
+// that the routes over a changed station are found without visiting the others
+
+static Subscriptions* subscriptionsInit (INTEGER size) {
+    Subscriptions *subscriptions = malloc(sizeof(Subscriptions));
+    subscriptions->data = malloc(size * sizeof(Subscription));
+    subscriptions->size = size;
+    subscriptions->used = 0;
+    subscriptions->reach = NULL;
+    subscriptions->leaves = 0;
+    subscriptions->dirty = true;
+    subscriptions->pending = malloc(size * sizeof(INTEGER));
+    subscriptions->pendingUsed = 0;
+    subscriptions->replanned = 0;
+    return subscriptions;
+}
+
+static void subscriptionsFree (Subscriptions *subscriptions) {
+    for (INTEGER idx = 0; idx < subscriptions->used; idx++) {
+        free(subscriptions->data[idx].path);
     }
-    setInsertNode(set, node);
+    free(subscriptions->data);
+    free(subscriptions->reach);
+    free(subscriptions->pending);
+    free(subscriptions);
 }
 
-void setInsertNode (Set *set, SetNode *node) {
-    SetNode **bucket = setBucket(set, node->key);
-    node->next = *bucket;
-    *bucket = node;
-    set->used++;
+static INTEGER subscriptionsLowerBound (Subscriptions *subscriptions, INTEGER start, INTEGER end) {
+    INTEGER low = start < end ? start : end, high = start < end ? end : start;
+    INTEGER first = 0, last = subscriptions->used, mid;
+    Subscription *subscription;
+    while (first < last) {
+        mid = (first + last) / 2;
+        subscription = subscriptions->data + mid;
+        if (subscription->low < low || (subscription->low == low && (subscription->high < high || (subscription->high == high && subscription->start < start)))) {
+            first = mid + 1;
+        } else {
+            last = mid;
+        }
+    }
+    return first;
 }
 
-bool setDelete (Set *set, INTEGER key) {
-    SetNode *prev = NULL;
-    SetNode *node = setSearch(set, key, &prev);
-    if (node == NULL) {
+static bool subscriptionsInsert (Subscriptions *subscriptions, INTEGER start, INTEGER end) {
+    INTEGER idx = subscriptionsLowerBound(subscriptions, start, end);
+    Subscription *subscription = subscriptions->data + idx;
+    if (idx < subscriptions->used && subscription->start == start && subscription->end == end) {
         return false;
     }
-    if (prev == NULL) {
-        SetNode **bucket = setBucket(set, key);
-        *bucket = node->next;
+    if (subscriptions->used == subscriptions->size) {
+        subscriptions->size *= VECTOR_SIZE_MULTIPLIER;
+        subscriptions->data = realloc(subscriptions->data, subscriptions->size * sizeof(Subscription));
+        subscriptions->pending = realloc(subscriptions->pending, subscriptions->size * sizeof(INTEGER));
+        subscription = subscriptions->data + idx;
     }
-    else {
-        prev->next = node->next;
+    memmove(subscription + 1, subscription, (subscriptions->used - idx) * sizeof(Subscription));
+    for (INTEGER pendingIdx = 0; pendingIdx < subscriptions->pendingUsed; pendingIdx++) {
+        if (subscriptions->pending[pendingIdx] >= idx) {
+            subscriptions->pending[pendingIdx]++;
+        }
     }
-    free(node);
-    set->used--;
+    subscription->start = start;
+    subscription->end = end;
+    subscription->low = start < end ? start : end;
+    subscription->high = start < end ? end : start;
+    subscription->path = NULL;
+    subscription->size = 0;
+    // no path compares equal to an unplanned one, so the first plan is always published
+    subscription->length = SUBSCRIPTION_UNPLANNED;
+    subscription->marked = false;
+    subscription->changed = false;
+    subscriptions->used++;
+    subscriptions->dirty = true;
+    subscriptionsMarkIdx(subscriptions, idx);
     return true;
-};
+}
 
+static bool subscriptionsDelete (Subscriptions *subscriptions, INTEGER start, INTEGER end) {
+    INTEGER idx = subscriptionsLowerBound(subscriptions, start, end), kept = 0;
+    Subscription *subscription = subscriptions->data + idx;
+    if (idx == subscriptions->used || subscription->start != start || subscription->end != end) {
+        return false;
+    }
+    free(subscription->path);
+    memmove(subscription, subscription + 1, (subscriptions->used - idx - 1) * sizeof(Subscription));
+    for (INTEGER pendingIdx = 0; pendingIdx < subscriptions->pendingUsed; pendingIdx++) {
+        if (subscriptions->pending[pendingIdx] != idx) {
+            subscriptions->pending[kept++] = subscriptions->pending[pendingIdx] - (subscriptions->pending[pendingIdx] > idx);
+        }
+    }
+    subscriptions->pendingUsed = kept;
+    subscriptions->used--;
+    subscriptions->dirty = true;
+    return true;
+}
 
+static void subscriptionsBuild (Subscriptions *subscriptions) {
+    INTEGER leaves = 1;
+    while (leaves < subscriptions->used) {
+        leaves *= 2;
+    }
+    if (leaves != subscriptions->leaves) {
+        subscriptions->leaves = leaves;
+        subscriptions->reach = realloc(subscriptions->reach, 2 * leaves * sizeof(INTEGER));
+    }
+    for (INTEGER idx = 0; idx < leaves; idx++) {
+        subscriptions->reach[leaves + idx] = idx < subscriptions->used ? subscriptions->data[idx].high : TREE_EMPTY_HIGH;
+    }
+    for (INTEGER idx = leaves - 1; idx > 0; idx--) {
+        subscriptions->reach[idx] = subscriptions->reach[2 * idx] > subscriptions->reach[2 * idx + 1] ? subscriptions->reach[2 * idx] : subscriptions->reach[2 * idx + 1];
+    }
+    subscriptions->dirty = false;
+}
 
-/******* HASH TABLE FUNCTIONS *******/
+static void subscriptionsMark (Subscriptions *subscriptions, INTEGER station) {
+    INTEGER first = 0, last = subscriptions->used, mid;
+    if (subscriptions->used == 0) {
+        return;
+    }
+    if (subscriptions->dirty) {
+        subscriptionsBuild(subscriptions);
+    }
+    // only the subscriptions before the first one starting past the station can contain it
+    while (first < last) {
+        mid = (first + last) / 2;
+        if (subscriptions->data[mid].low <= station) {
+            first = mid + 1;
+        } else {
+            last = mid;
+        }
+    }
+    subscriptionsMarkNode(subscriptions, 1, 0, subscriptions->leaves, first, station);
+}
 
-HashTable* htInit (INTEGER size) {
-    HashTable *ht = malloc(sizeof(HashTable));
-    ht->data = malloc(size * sizeof(HTNode*));
-    ht->size = size;
-    ht->used = 0;
-    for (INTEGER bucketIdx = 0; bucketIdx < size; bucketIdx++) {
-        ht->data[bucketIdx] = NULL;
+static void subscriptionsMarkNode (Subscriptions *subscriptions, INTEGER node, INTEGER first, INTEGER last, INTEGER count, INTEGER station) {
+    if (first >= count || subscriptions->reach[node] < station) {
+        return;
     }
-    return ht;
-};
+    if (node >= subscriptions->leaves) {
+        subscriptionsMarkIdx(subscriptions, node - subscriptions->leaves);
+        return;
+    }
+    subscriptionsMarkNode(subscriptions, 2 * node, first, (first + last) / 2, count, station);
+    subscriptionsMarkNode(subscriptions, 2 * node + 1, (first + last) / 2, last, count, station);
+}
 
-INTEGER htBucketIdx (HashTable *ht, INTEGER key) {
-    return key % ht->size;
+static void subscriptionsMarkIdx (Subscriptions *subscriptions, INTEGER idx) {
+    Subscription *subscription = subscriptions->data + idx;
+    // a subscription is pending once, whether to be planned again, published or both
+    if (!subscription->marked && !subscription->changed) {
+        subscriptions->pending[subscriptions->pendingUsed++] = idx;
+    }
+    subscription->marked = true;
 }
 
-HTNode** htBucket (HashTable *ht, INTEGER key) {
-    INTEGER index = htBucketIdx(ht, key);
-    return ht->data + index;
+static void subscriptionsMarkAll (Subscriptions *subscriptions) {
+    for (INTEGER idx = 0; idx < subscriptions->used; idx++) {
+        subscriptionsMarkIdx(subscriptions, idx);
+    }
 }
 
-void htIter (HashTable *ht) {
-    if (ht == NULL) {
-        return;
+static void subscriptionsReplan (void *context, KEY *path, INTEGER length) {
+    Subscriptions *subscriptions = context;
+    Subscription *subscription;
+    // the replies follow the marked pending subscriptions in order
+    while (!subscriptions->data[subscriptions->pending[subscriptions->replanned]].marked) {
+        subscriptions->replanned++;
     }
-    ht->iterator = NULL;
-    ht->iterationFinished = false;
+    subscription = subscriptions->data + subscriptions->pending[subscriptions->replanned++];
+    subscription->marked = false;
+    subscriptionsStore(subscription, path, length);
 }
 
-HTNode* htNext (HashTable *ht) {
-    if (ht == NULL || ht->iterationFinished) {
-        return NULL;
+static void subscriptionsStore (Subscription *subscription, KEY *path, INTEGER length) {
+    if (subscription->length == length && (length <= 0 || memcmp(subscription->path, path, length * sizeof(KEY)) == 0)) {
+        return;
     }
-    if (ht->iterator != NULL && ht->iterator->next != NULL) {
-        ht->iterator = ht->iterator->next;
-        return ht->iterator;
+    if (length > 0 && length > subscription->size) {
+        subscription->size = length;
+        subscription->path = realloc(subscription->path, length * sizeof(KEY));
     }
-    HTNode *next;
-    INTEGER bucketIdx;
-    if (ht->iterator == NULL) {
-        bucketIdx = 0;
-    } else {
-        bucketIdx = htBucketIdx(ht, ht->iterator->key) + 1;
+    if (length > 0) {
+        memcpy(subscription->path, path, length * sizeof(KEY));
     }
-    for (; bucketIdx < ht->size; bucketIdx++) {
-        next = ht->data[bucketIdx];
-        if (next != NULL) {
-            ht->iterator = next;
-            return ht->iterator;
-        }
+    subscription->length = length;
+    subscription->changed = true;
+}
+
+static int subscriptionsCompareIdx (const void *data1, const void *data2) {
+    INTEGER idx1 = *(INTEGER*) data1, idx2 = *(INTEGER*) data2;
+    return (idx1 > idx2) - (idx1 < idx2);
+}
+
+static INTEGER subscriptionsBytes (Subscriptions *subscriptions) {
+    INTEGER bytes = sizeof(Subscriptions) + subscriptions->size * (sizeof(Subscription) + sizeof(INTEGER)) + 2 * subscriptions->leaves * sizeof(INTEGER);
+    for (INTEGER idx = 0; idx < subscriptions->used; idx++) {
+        bytes += subscriptions->data[idx].size * sizeof(KEY);
     }
-    ht->iterator = NULL;
-    ht->iterationFinished = true;
-    return NULL;
+    return bytes;
 }
 
-void htFree (HashTable *ht) {
-    if (ht == NULL) {
-        return;
+
+
+#ifndef PLANNER_LIBRARY
+
+/******* HIGHWAY FUNCTIONS *******/
+
+// each highway is a shard with its own planner, always run by the same worker;
+// commands are queued by shard in chunks, the workers run their shards in
+// parallel, and the replies are merged back in input order
+
+static Highways* highwaysInit (Planner *planner, INTEGER workersUsed) {
+    Highways *highways = malloc(sizeof(Highways));
+    highways->shards = malloc(HIGHWAY_INITIAL_SIZE * sizeof(Shard));
+    highways->sorted = malloc(HIGHWAY_INITIAL_SIZE * sizeof(INTEGER));
+    highways->size = HIGHWAY_INITIAL_SIZE;
+    highways->used = 0;
+    highways->order = malloc(HIGHWAY_CHUNK * sizeof(INTEGER));
+    highways->orderUsed = 0;
+    highways->workers = malloc(workersUsed * sizeof(HighwayWorker));
+    highways->workersUsed = workersUsed;
+    highways->stopped = false;
+    highways->running = false;
+    highways->pushing = NULL;
+    // the default highway keeps the planner of the commands run before
+    Shard *shard = highwaysGetShard(highways, DEFAULT_HIGHWAY);
+    plannerFree(shard->planner);
+    shard->planner = planner;
+    plannerSetReply(planner, printPath, shard->output);
+    for (INTEGER workerIdx = 0; workerIdx < workersUsed; workerIdx++) {
+        highways->workers[workerIdx].highways = highways;
+        highways->workers[workerIdx].id = workerIdx;
     }
-    htIter(ht);
-    HTNode *node = htNext(ht);
-    HTNode *temp = NULL;
-    while (node != NULL) {
-        temp = htNext(ht);
-        setFree(node->value);
-        free(node);
-        node = temp;
+    if (workersUsed > 1) {
+        pthread_barrier_init(&highways->barrier, NULL, workersUsed);
+        for (INTEGER workerIdx = 1; workerIdx < workersUsed; workerIdx++) {
+            pthread_create(&highways->workers[workerIdx].thread, NULL, highwaysRunWorker, highways->workers + workerIdx);
+        }
     }
-    free(ht->data);
-    free(ht);
+    return highways;
 }
 
-bool htShouldResize (HashTable *ht) {
-    return ht->used >= HT_LOAD_FACTOR * ht->size;
+static void highwaysFree (Highways *highways) {
+    if (highways->workersUsed > 1) {
+        highways->stopped = true;
+        pthread_barrier_wait(&highways->barrier);
+        for (INTEGER workerIdx = 1; workerIdx < highways->workersUsed; workerIdx++) {
+            pthread_join(highways->workers[workerIdx].thread, NULL);
+        }
+        pthread_barrier_destroy(&highways->barrier);
+    }
+    for (INTEGER shardIdx = 0; shardIdx < highways->used; shardIdx++) {
+        Shard *shard = highways->shards + shardIdx;
+        if (shard->highway == DEFAULT_HIGHWAY) {
+            plannerSetReply(shard->planner, printPath, output);
+        } else {
+            plannerFree(shard->planner);
+        }
+        inputFree(shard->input);
+        outputFree(shard->output);
+    }
+    free(highways->shards);
+    free(highways->sorted);
+    free(highways->order);
+    free(highways->workers);
+    free(highways);
 }
 
-void htResize (HashTable *ht) {
-    HashTable *tempHt = htInit(HT_SIZE_MULTIPLIER * ht->size);
-    htIter(ht);
-    HTNode *node = htNext(ht);
-    HTNode *temp = NULL;
-    while (node != NULL) {
-        temp = htNext(ht);
-        htInsertNode(tempHt, node);
-        node = temp;
+static Shard* highwaysGetShard (Highways *highways, INTEGER highway) {
+    INTEGER low = 0, high = highways->used, mid;
+    while (low < high) {
+        mid = (low + high) / 2;
+        if (highways->shards[highways->sorted[mid]].highway < highway) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
     }
-    free(ht->data);
-    ht->data = tempHt->data;
-    ht->size = tempHt->size;
-    ht->used = tempHt->used;
-    free(tempHt);
-};
-
-HTNode* htSearch (HashTable *ht, INTEGER key, HTNode **deleteHelper) {
-    HTNode *prev = NULL;
-    HTNode *node = *htBucket(ht, key);
-    while (node != NULL && node->key != key) {
-        prev = node;
-        node = node->next;
+    if (low < highways->used && highways->shards[highways->sorted[low]].highway == highway) {
+        return highways->shards + highways->sorted[low];
     }
-    if (deleteHelper != NULL) {
-        *deleteHelper = prev;
+
+    // shards keep their creation index, which picks their worker, and are
+    // found through the indices sorted by highway
+    if (highways->used == highways->size) {
+        highways->size *= VECTOR_SIZE_MULTIPLIER;
+        highways->shards = realloc(highways->shards, highways->size * sizeof(Shard));
+        highways->sorted = realloc(highways->sorted, highways->size * sizeof(INTEGER));
     }
-    return node;
-};
+    memmove(highways->sorted + low + 1, highways->sorted + low, (highways->used - low) * sizeof(INTEGER));
+    highways->sorted[low] = highways->used;
+    Shard *shard = highways->shards + highways->used;
+    shard->highway = highway;
+    shard->worker = highways->used % highways->workersUsed;
+    shard->input = inputInitQueue(HIGHWAY_CHUNK);
+    shard->output = outputInitReplies(OUTPUT_BUFFER_SIZE);
+    shard->output->binary = output->binary;
+    shard->planner = plannerInit(1, printPath, shard->output);
+    shard->merged = 0;
+    shard->offset = 0;
+    highways->used++;
+    return shard;
+}
 
-void htInsert (HashTable *ht, INTEGER key) {
-    HTNode *node = htSearch(ht, key, NULL), *newNode;
-    if (node != NULL) {
-        return;
+static void highwaysPush (Highways *highways, INTEGER highway, int command, Input *input) {
+    Shard *shard = highwaysGetShard(highways, highway);
+    INTEGER counter;
+    // the command joins the order once it is queued whole, so that an error
+    // while reading it leaves only complete commands behind
+    highways->pushing = shard;
+    highways->pushed = shard->input->queuedUsed;
+    inputQueue(shard->input, command);
+    if (command == ADD_STATION_COMMAND) {
+        inputQueue(shard->input, inputReadInt(input));
+        counter = inputReadInt(input);
+        inputQueue(shard->input, counter);
+        for (INTEGER i = 1; i <= counter; i++) {
+            inputQueue(shard->input, inputReadInt(input));
+        }
     }
-    newNode = malloc(sizeof(HTNode));
-    newNode->key = key;
-    newNode->value = NULL;
-    newNode->next = NULL;
-    if (htShouldResize(ht)) {
-        htResize(ht);
+    else if (command == DEL_STATION_COMMAND) {
+        inputQueue(shard->input, inputReadInt(input));
+    }
+    else if (command == ADD_CAR_COMMAND || command == DEL_CAR_COMMAND || command == FIND_PATH_COMMAND || command == COUNT_STOPS_COMMAND || command == SUBSCRIBE_COMMAND || command == UNSUBSCRIBE_COMMAND) {
+        inputQueue(shard->input, inputReadInt(input));
+        inputQueue(shard->input, inputReadInt(input));
+    }
+    else {
+        raiseCustomError(input->error != NULL ? input->error : "unable to execute command");
     }
-    htInsertNode(ht, newNode);
+    highways->pushing = NULL;
+    highways->order[highways->orderUsed++] = shard - highways->shards;
 }
 
-void htInsertNode (HashTable *ht, HTNode *node) {
-    if (node == NULL) {
+static bool highwaysIsFull (Highways *highways) {
+    return highways->orderUsed == HIGHWAY_CHUNK;
+}
+
+static void highwaysRun (Highways *highways) {
+    Shard *shard;
+    INTEGER end;
+    if (highways->orderUsed == 0) {
         return;
     }
-    HTNode **bucket = htBucket(ht, node->key);
-    if (bucket == NULL) {
-        return;
+    highways->running = true;
+    if (highways->workersUsed > 1) {
+        pthread_barrier_wait(&highways->barrier);
+        highwaysWork(highways, 0);
+        pthread_barrier_wait(&highways->barrier);
+    } else {
+        highwaysWork(highways, 0);
     }
-    node->next = *bucket;
-    *bucket = node;
-    ht->used++;
+    highways->running = false;
+
+    // every command has exactly one reply, so the order of the commands
+    // tells which shard holds the next reply
+    for (INTEGER orderIdx = 0; orderIdx < highways->orderUsed; orderIdx++) {
+        shard = highways->shards + highways->order[orderIdx];
+        end = shard->output->ends[shard->merged++];
+        outputWrite(output, shard->output->data + shard->offset, end - shard->offset);
+        shard->offset = end;
+    }
+    for (INTEGER shardIdx = 0; shardIdx < highways->used; shardIdx++) {
+        shard = highways->shards + shardIdx;
+        inputClearQueue(shard->input);
+        outputClearReplies(shard->output);
+        shard->merged = 0;
+        shard->offset = 0;
+    }
+    highways->orderUsed = 0;
 }
 
-bool htDelete (HashTable *ht, INTEGER key) {
-    HTNode *prev = NULL;
-    HTNode *node = htSearch(ht, key, &prev);
-    if (node == NULL) {
-        return false;
+static void highwaysFlush (Highways *highways) {
+    if (highways->pushing != NULL) {
+        highways->pushing->input->queuedUsed = highways->pushed;
+        highways->pushing = NULL;
     }
-    if (prev == NULL) {
-        HTNode **bucket = htBucket(ht, key);
-        *bucket = node->next;
+    highwaysRun(highways);
+}
+
+static void* highwaysRunWorker (void *data) {
+    HighwayWorker *worker = data;
+    Highways *highways = worker->highways;
+    while (true) {
+        pthread_barrier_wait(&highways->barrier);
+        if (highways->stopped) {
+            return NULL;
+        }
+        highwaysWork(highways, worker->id);
+        pthread_barrier_wait(&highways->barrier);
     }
-    else {
-        prev->next = node->next;
+}
+
+static void highwaysWork (Highways *highways, INTEGER workerId) {
+    Shard *shard;
+    int command;
+    for (INTEGER shardIdx = 0; shardIdx < highways->used; shardIdx++) {
+        shard = highways->shards + shardIdx;
+        if (shard->worker != workerId || shard->input->queuedUsed == 0) {
+            continue;
+        }
+        while ((command = inputReadCommand(shard->input)) != EOF) {
+            runCommand(shard->input, shard->planner, shard->output, command);
+        }
+        plannerAnswerPaths(shard->planner);
     }
-    setFree(node->value);
-    free(node);
-    ht->used--;
-    return true;
-};
+}
 
+#endif
 
 
-/******* VECTOR FUNCTIONS *******/
 
-Vector* vectorInit (INTEGER size) {
-    Vector *v = malloc(sizeof(Vector));
-    v->data = malloc(size * sizeof(StationCar));
-    v->size = size;
-    v->used = 0;
-    return v;
+/******* STATS FUNCTIONS *******/
+static INTEGER statsClock () {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000l + now.tv_nsec;
 }
-void vectorFree (Vector *v) {
-    free(v->data);
-    free(v);
+
+static INTEGER statsBucketIdx (INTEGER value) {
+    // log-linear buckets: each power of two is split in 2^STATS_SUB_BITS slots,
+    // so every bucket is within a few percent of the values it holds
+    if (value < (1l << STATS_SUB_BITS)) {
+        return value < 0 ? 0 : value;
+    }
+    INTEGER exponent = 63 - __builtin_clzl(value);
+    INTEGER sub = (value >> (exponent - STATS_SUB_BITS)) & ((1l << STATS_SUB_BITS) - 1);
+    return ((exponent - STATS_SUB_BITS + 1) << STATS_SUB_BITS) + sub;
 }
-void vectorResize (Vector *v) {
-    INTEGER newSize = VECTOR_SIZE_MULTIPLIER * v->size;
-    v->data = realloc(v->data, newSize * sizeof(StationCar));
-    v->size = newSize;
+
+static void statsRecord (Histogram *histogram, INTEGER value) {
+    INTEGER max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    atomic_fetch_add_explicit(histogram->counts + statsBucketIdx(value), 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->total, value, memory_order_relaxed);
+    while (value > max && !atomic_compare_exchange_weak_explicit(&histogram->max, &max, value, memory_order_relaxed, memory_order_relaxed));
 }
-INTEGER vectorLength (Vector *v) {
-    return v->used;
+
+static void statsCount (atomic_long *counter) {
+    atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
 }
-StationCar* vectorGet (Vector *v, INTEGER idx) {
-    if (idx < 0 || idx > vectorLength(v)) {
-        raiseCustomError("invalid index (get)");
+
+#ifndef PLANNER_LIBRARY
+
+static Stats* statsInit (char *path) {
+    if (path == NULL) {
         return NULL;
     }
-    return v->data + idx;
+    Stats *stats = calloc(1, sizeof(Stats));
+    stats->path = path;
+    return stats;
 }
-INTEGER vectorGetStation (Vector *v, INTEGER idx) {
-    StationCar *node = vectorGet(v, idx);
-    if (node) {
-        return node->station;
-    } else {
-        return -1;
+
+static void statsFree (Stats *stats) {
+    free(stats);
+}
+
+static INTEGER statsBucketValue (INTEGER bucketIdx) {
+    if (bucketIdx < (1l << STATS_SUB_BITS)) {
+        return bucketIdx;
     }
+    INTEGER exponent = (bucketIdx >> STATS_SUB_BITS) + STATS_SUB_BITS - 1;
+    INTEGER sub = bucketIdx & ((1l << STATS_SUB_BITS) - 1);
+    return ((1l << STATS_SUB_BITS) + sub) << (exponent - STATS_SUB_BITS);
 }
-INTEGER vectorGetCar (Vector *v, INTEGER idx) {
-    StationCar *node = vectorGet(v, idx);
-    if (node) {
-        return node->car;
-    } else {
-        return -1;
+
+static INTEGER statsPercentile (Histogram *histogram, double fraction) {
+    INTEGER count = atomic_load(&histogram->count), seen = 0;
+    INTEGER rank = (INTEGER) (fraction * count + 0.999999);
+    for (INTEGER bucketIdx = 0; bucketIdx < STATS_BUCKETS; bucketIdx++) {
+        seen += atomic_load(histogram->counts + bucketIdx);
+        if (seen >= rank && seen > 0) {
+            return statsBucketValue(bucketIdx);
+        }
     }
+    return 0;
 }
-void vectorSet (Vector *v, INTEGER idx, INTEGER station, INTEGER car) {
-    if (idx < 0 || idx > vectorLength(v)) {
-        raiseCustomError("invalid index (set)");
-        return;
+
+static void statsDumpHistogram (FILE *file, char *name, Histogram *histogram) {
+    INTEGER count;
+    fprintf(file, "histogram %s %ld %ld %ld %ld %ld %ld %ld\n", name, atomic_load(&histogram->count), atomic_load(&histogram->total), atomic_load(&histogram->max), statsPercentile(histogram, 0.5), statsPercentile(histogram, 0.9), statsPercentile(histogram, 0.99), statsPercentile(histogram, 0.999));
+    for (INTEGER bucketIdx = 0; bucketIdx < STATS_BUCKETS; bucketIdx++) {
+        count = atomic_load(histogram->counts + bucketIdx);
+        if (count > 0) {
+            fprintf(file, "bucket %s %ld %ld\n", name, statsBucketValue(bucketIdx), count);
+        }
     }
-    if (vectorLength(v) == v->size) {
-        vectorResize(v);
+}
+
+static void statsDump (Stats *stats) {
+    // "-" or an empty value selects stderr, anything else is a file path
+    bool toStderr = stats->path[0] == '\0' || strcmp(stats->path, "-") == 0;
+    FILE *file = toStderr ? stderr : fopen(stats->path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "[ERROR]: unable to write stats\n");
+        return;
     }
-    v->data[idx].station = station;
-    v->data[idx].car = car;
-    if (idx == vectorLength(v)) {
-        v->used++;
+    fprintf(file, "# counter NAME VALUE\n");
+    fprintf(file, "# histogram NAME COUNT TOTAL MAX P50 P90 P99 P999\n");
+    fprintf(file, "# bucket NAME LOWER_BOUND COUNT\n");
+    fprintf(file, "counter ht.resizes %ld\n", atomic_load(&stats->htResizes));
+    fprintf(file, "counter ht.shrinks %ld\n", atomic_load(&stats->htShrinks));
+    fprintf(file, "counter set.resizes %ld\n", atomic_load(&stats->setResizes));
+    fprintf(file, "counter set.shrinks %ld\n", atomic_load(&stats->setShrinks));
+    fprintf(file, "counter cache.hits %ld\n", atomic_load(&stats->cacheHits));
+    fprintf(file, "counter cache.misses %ld\n", atomic_load(&stats->cacheMisses));
+    statsDumpHistogram(file, "command.ns." ADD_STATION, stats->commands + ADD_STATION_COMMAND);
+    statsDumpHistogram(file, "command.ns." DEL_STATION, stats->commands + DEL_STATION_COMMAND);
+    statsDumpHistogram(file, "command.ns." ADD_CAR, stats->commands + ADD_CAR_COMMAND);
+    statsDumpHistogram(file, "command.ns." DEL_CAR, stats->commands + DEL_CAR_COMMAND);
+    statsDumpHistogram(file, "command.ns." FIND_PATH, stats->commands + FIND_PATH_COMMAND);
+    statsDumpHistogram(file, "command.ns." COUNT_STOPS, stats->commands + COUNT_STOPS_COMMAND);
+    statsDumpHistogram(file, "command.ns." SUBSCRIBE, stats->commands + SUBSCRIBE_COMMAND);
+    statsDumpHistogram(file, "command.ns." UNSUBSCRIBE, stats->commands + UNSUBSCRIBE_COMMAND);
+    statsDumpHistogram(file, "batch.ns", &stats->batches);
+    statsDumpHistogram(file, "plan.scanned", &stats->scanned);
+    statsDumpHistogram(file, "plan.stops", &stats->stops);
+    statsDumpHistogram(file, "plan.fixups", &stats->fixups);
+    statsDumpHistogram(file, "ht.probes", &stats->htProbes);
+    statsDumpHistogram(file, "set.probes", &stats->setProbes);
+    if (!toStderr) {
+        fclose(file);
     }
 }
-void vectorPush (Vector *v, INTEGER station, INTEGER car) {
-    vectorSet(v, vectorLength(v), station, car);
-}
-INTEGER vectorFindStation (Vector *v, INTEGER station) {
-    for (INTEGER idx = 0; idx < vectorLength(v); idx++) {     
-        if (vectorGetStation(v, idx) == station) {
-            return idx;
-        }     
+
+#endif
+
+
+
+/******* SNAPSHOT FUNCTIONS *******/
+
+// a snapshot is the magic string with the width of INTEGER as last byte, the number
+// of stations and then, by increasing station, the station, the number of distinct
+// cars and a (car, count) pair for each of them, all as native INTEGERs
+
+static bool snapshotSave (char *path, Planner *planner) {
+    HashTable *stations = planner->stations;
+    Vector *bestCars = planner->bestCars;
+    FILE *file = fopen(path, "wb");
+    char header[SNAPSHOT_HEADER_SIZE] = SNAPSHOT_MAGIC;
+    INTEGER count = vectorLength(bestCars), station, car, iterator;
+    Set *cars;
+    if (file == NULL) {
+        return false;
     }
-    raiseCustomError("unable to find vector idx");
-    return -1;
-}
-void vectorSortByStation (Vector *v) {
-    qsort(v->data, vectorLength(v), sizeof(StationCar), vectorCompareByStation);
+    header[SNAPSHOT_HEADER_SIZE - 1] = (char) sizeof(INTEGER);
+    fwrite(header, 1, SNAPSHOT_HEADER_SIZE, file);
+    fwrite(&count, sizeof(INTEGER), 1, file);
+    for (INTEGER idx = 0; idx < vectorLength(bestCars); idx++) {
+        station = vectorGetStation(bestCars, idx);
+        cars = htSearch(stations, station)->value;
+        count = cars != NULL ? cars->used : 0;
+        fwrite(&station, sizeof(INTEGER), 1, file);
+        fwrite(&count, sizeof(INTEGER), 1, file);
+        setIter(&iterator);
+        for (SetNode *node = setNext(cars, &iterator); node; node = setNext(cars, &iterator)) {
+            car = node->key;
+            count = node->count;
+            fwrite(&car, sizeof(INTEGER), 1, file);
+            fwrite(&count, sizeof(INTEGER), 1, file);
+        }
+    }
+    return fclose(file) == 0;
 }
-int vectorCompareByStation (const void *data1, const void *data2) {
-    StationCar *node1 = (StationCar*) data1;
-    StationCar *node2 = (StationCar*) data2;
-    return node1->station - node2->station;
+
+static bool snapshotLoad (char *path, Planner *planner) {
+    HashTable *stations = planner->stations;
+    Vector *bestCars = planner->bestCars;
+    int descriptor = open(path, O_RDONLY);
+    struct stat info;
+    char header[SNAPSHOT_HEADER_SIZE] = SNAPSHOT_MAGIC;
+    INTEGER *data, length, position = 1, count, size;
+    HTNode *nodes;
+    Set *cars;
+    Heap *maxHeap;
+    header[SNAPSHOT_HEADER_SIZE - 1] = (char) sizeof(INTEGER);
+    if (descriptor < 0) {
+        return false;
+    }
+    if (fstat(descriptor, &info) < 0 || info.st_size < SNAPSHOT_HEADER_SIZE + (INTEGER) sizeof(INTEGER)) {
+        close(descriptor);
+        return false;
+    }
+    char *mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    data = (INTEGER*) (mapped + SNAPSHOT_HEADER_SIZE);
+    length = (info.st_size - SNAPSHOT_HEADER_SIZE) / sizeof(INTEGER);
+    if (memcmp(mapped, header, SNAPSHOT_HEADER_SIZE) != 0 || (info.st_size - SNAPSHOT_HEADER_SIZE) % sizeof(INTEGER) != 0 || !snapshotIsValid(data, length, bestCars)) {
+        munmap(mapped, info.st_size);
+        return false;
+    }
+
+    // the car tables are built aside, since a car listed twice is only found
+    // while building them, and the planner is filled once they all are
+    nodes = malloc(data[0] * sizeof(HTNode));
+    for (INTEGER stationIdx = 0; stationIdx < data[0]; stationIdx++) {
+        count = data[position + 1];
+        cars = NULL;
+        maxHeap = NULL;
+        if (count > 0) {
+            for (size = HT_INITIAL_SIZE; HT_LOAD_FACTOR * size <= count; size *= HT_SIZE_MULTIPLIER);
+            cars = setInit(size);
+            maxHeap = heapInit(count);
+        }
+        nodes[stationIdx] = (HTNode) {data[position], cars, maxHeap, NULL};
+        position += 2;
+        for (INTEGER carIdx = 0; carIdx < count; carIdx++, position += 2) {
+            if (setSearch(cars, data[position]) != NULL) {
+                for (INTEGER nodeIdx = 0; nodeIdx <= stationIdx; nodeIdx++) {
+                    setFree(nodes[nodeIdx].value);
+                    heapFree(nodes[nodeIdx].maxHeap);
+                }
+                free(nodes);
+                munmap(mapped, info.st_size);
+                return false;
+            }
+            setInsertNode(cars, (SetNode) {data[position], data[position + 1]});
+            heapPush(maxHeap, data[position]);
+        }
+    }
+
+    // the stations come sorted, so the index is appended to and every table
+    // is sized once instead of growing insert by insert
+    while (HT_LOAD_FACTOR * stations->size <= vectorLength(bestCars) + data[0]) {
+        htResize(stations, HT_SIZE_MULTIPLIER * stations->size);
+    }
+    for (INTEGER stationIdx = 0; stationIdx < data[0]; stationIdx++) {
+        htInsertNode(stations, nodes[stationIdx]);
+        vectorPush(bestCars, nodes[stationIdx].key, nodes[stationIdx].maxHeap != NULL ? heapTop(nodes[stationIdx].maxHeap) : 0);
+    }
+    free(nodes);
+    munmap(mapped, info.st_size);
+    jumpMarkStations(planner->jump);
+    planner->tree->dirty = true;
+    return true;
 }
-INTEGER vectorGetStationsDist (Vector *v, INTEGER idx1, INTEGER idx2) {
-    INTEGER station1 = vectorGetStation(v, idx1);
-    INTEGER station2 = vectorGetStation(v, idx2);
-    return abs(station2 - station1);
+
+static bool snapshotIsValid (INTEGER *data, INTEGER length, Vector *bestCars) {
+    // every count is checked against the length of the file before it sizes anything,
+    // and the stations must follow the ones already in the planner
+    INTEGER position = 1, station, count;
+    INTEGER last = vectorLength(bestCars) > 0 ? vectorGetStation(bestCars, vectorLength(bestCars) - 1) : -1;
+    if (data[0] < 0 || data[0] > (length - 1) / 2) {
+        return false;
+    }
+    for (INTEGER stationIdx = 0; stationIdx < data[0]; stationIdx++) {
+        if (length - position < 2) {
+            return false;
+        }
+        station = data[position];
+        count = data[position + 1];
+        position += 2;
+        // snapshots always hold INTEGERs, which must also fit the narrower keys of this build
+        if (station <= last || !isKey(station) || count < 0 || count > (length - position) / 2) {
+            return false;
+        }
+        for (INTEGER carIdx = 0; carIdx < count; carIdx++, position += 2) {
+            if (!isKey(data[position]) || data[position + 1] <= 0 || (KEY) data[position + 1] != data[position + 1]) {
+                return false;
+            }
+        }
+        last = station;
+    }
+    return position == length;
 }
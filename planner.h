@@ -0,0 +1,64 @@
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+
+/******* CONSTANTS AND TYPES *******/
+
+#define PLANNER_NO_PATH -1
+
+// every value crosses the API in 64 bits, whatever width the library stores
+// stations and cars in
+typedef int64_t planner_int_t;
+
+typedef struct Planner Planner;
+
+// receives the stations of a path, or PLANNER_NO_PATH as length when there is none;
+// the stations are only valid until the callback returns
+typedef void (*PlannerReply) (void *context, planner_int_t *path, planner_int_t length);
+
+// receives a subscribed route, from start to end, with its new path as for PlannerReply
+typedef void (*PlannerUpdate) (void *context, planner_int_t start, planner_int_t end, planner_int_t *path, planner_int_t length);
+
+
+
+/******* PLANNER FUNCTION PROTOTYPES *******/
+
+// queued paths are answered in batches through reply, which may be NULL when
+// plannerQueuePath is never used; every other call answers the pending paths
+// first, so replies keep the order of the calls; no call exits the program:
+// stations and cars that are negative or too wide for the library are refused, and
+// a path or hop count from or to a missing station is PLANNER_NO_PATH
+Planner* plannerInit (planner_int_t workers, PlannerReply reply, void *context);
+void plannerFree (Planner *planner);
+bool plannerAddStation (Planner *planner, planner_int_t station);
+bool plannerDelStation (Planner *planner, planner_int_t station);
+bool plannerAddCar (Planner *planner, planner_int_t station, planner_int_t car);
+bool plannerDelCar (Planner *planner, planner_int_t station, planner_int_t car);
+// writes up to size stations of the path into path and returns its full length,
+// or PLANNER_NO_PATH
+planner_int_t plannerGetPath (Planner *planner, planner_int_t start, planner_int_t end, planner_int_t *path, planner_int_t size);
+planner_int_t plannerCountHops (Planner *planner, planner_int_t start, planner_int_t end);
+// returns false, queuing nothing, when the planner has no reply
+bool plannerQueuePath (Planner *planner, planner_int_t start, planner_int_t end);
+void plannerAnswerPaths (Planner *planner);
+void plannerSetReply (Planner *planner, PlannerReply reply, void *context);
+// return false when the file cannot be written, or cannot be read or is not a valid
+// snapshot whose stations all follow the current ones; a failed load changes nothing
+bool plannerSave (Planner *planner, char *path);
+bool plannerLoad (Planner *planner, char *path);
+// subscribed routes are planned again only after a change to a station between
+// their ends; plannerRefreshSubscriptions returns how many of them changed path,
+// and plannerPublishSubscriptions passes those to update in order of their lower
+// end; a new subscription is published with its first path
+bool plannerSubscribe (Planner *planner, planner_int_t start, planner_int_t end);
+bool plannerUnsubscribe (Planner *planner, planner_int_t start, planner_int_t end);
+planner_int_t plannerRefreshSubscriptions (Planner *planner);
+void plannerPublishSubscriptions (Planner *planner, PlannerUpdate update, void *context);
+void plannerReportMemory (Planner *planner, FILE *file);
+
+#endif
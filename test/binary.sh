@@ -0,0 +1,36 @@
+#!/bin/sh
+# feeds binary commands with negative ids to the planner given as argument,
+# and checks that each one is refused as for a missing station
+planner=${1:-./main}
+
+# writes a command code as a byte
+code () {
+    printf "\\$(printf '%03o' "$1")"
+}
+
+# writes an integer as 8 little endian bytes
+int () {
+    for shift in 0 8 16 24 32 40 48 56; do
+        code $(( ($1 >> shift) & 255 ))
+    done
+}
+
+replies=$({
+    code 1; int 10; int 1; int 5
+    code 3; int -1; int 7
+    code 3; int 10; int -1
+    code 4; int -1; int 7
+    code 4; int 10; int -1
+    code 2; int -1
+    code 5; int -1; int 10
+    code 6; int 10; int -1
+    code 5; int 10; int 10
+} | PLANNER_BINARY=1 "$planner" | od -An -v -tx1 | tr -d ' \n')
+
+# added, four refused car commands, a refused demolition, two missing paths and the path 10
+expected=010000000000ffffffffffffffffffffffffffffffff01000000000000000a00000000000000
+if [ "$replies" != "$expected" ]; then
+    echo "binary: expected $expected, got $replies"
+    exit 1
+fi
+echo "binary: ok"
@@ -0,0 +1,90 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../planner.h"
+
+
+/******* CONSTANTS AND TYPES *******/
+
+#define TEST_STATION 10
+#define TEST_CAR 7
+#define TEST_MISSING -1
+#define TEST_PATH_SIZE 4
+
+typedef struct Replies Replies;
+
+struct Replies {
+    planner_int_t count, length, first;
+};
+
+
+
+/******* FUNCTION PROTOTYPES *******/
+
+void raiseCustomError (char *message);
+void check (bool condition, char *message);
+void countReply (void *context, planner_int_t *path, planner_int_t length);
+void testNegativeIds ();
+
+
+
+/******* MAIN *******/
+
+int main () {
+    testNegativeIds();
+    printf("library: ok\n");
+    return EXIT_SUCCESS;
+}
+
+
+
+/******* TESTS *******/
+
+void raiseCustomError (char *message) {
+    printf("[ERROR]: %s\n", message);
+    exit(EXIT_FAILURE);
+}
+
+void check (bool condition, char *message) {
+    if (!condition) {
+        raiseCustomError(message);
+    }
+}
+
+void countReply (void *context, planner_int_t *path, planner_int_t length) {
+    Replies *replies = context;
+    replies->count++;
+    replies->length = length;
+    replies->first = length > 0 ? path[0] : PLANNER_NO_PATH;
+}
+
+// a negative id is refused by every call, and leaves the planner as it was
+void testNegativeIds () {
+    Replies replies = {0, 0, 0};
+    planner_int_t path[TEST_PATH_SIZE];
+    Planner *planner = plannerInit(1, countReply, &replies);
+    check(!plannerAddStation(planner, TEST_MISSING), "negative station added");
+    check(!plannerDelStation(planner, TEST_MISSING), "negative station demolished");
+    check(plannerAddStation(planner, TEST_STATION), "station not added");
+    check(!plannerAddCar(planner, TEST_MISSING, TEST_CAR), "car added to a negative station");
+    check(!plannerAddCar(planner, TEST_STATION, TEST_MISSING), "negative car added");
+    check(!plannerDelCar(planner, TEST_MISSING, TEST_CAR), "car scrapped from a negative station");
+    check(!plannerDelCar(planner, TEST_STATION, TEST_MISSING), "negative car scrapped");
+    check(plannerGetPath(planner, TEST_MISSING, TEST_STATION, path, TEST_PATH_SIZE) == PLANNER_NO_PATH, "path from a negative station");
+    check(plannerGetPath(planner, TEST_STATION, TEST_MISSING, path, TEST_PATH_SIZE) == PLANNER_NO_PATH, "path to a negative station");
+    check(plannerCountHops(planner, TEST_MISSING, TEST_STATION) == PLANNER_NO_PATH, "hops from a negative station");
+    check(plannerCountHops(planner, TEST_STATION, TEST_MISSING) == PLANNER_NO_PATH, "hops to a negative station");
+    check(plannerQueuePath(planner, TEST_MISSING, TEST_STATION), "path not queued");
+    plannerAnswerPaths(planner);
+    check(replies.count == 1 && replies.length == PLANNER_NO_PATH, "queued path from a negative station");
+    check(!plannerSubscribe(planner, TEST_MISSING, TEST_STATION), "negative route subscribed");
+    check(!plannerUnsubscribe(planner, TEST_STATION, TEST_MISSING), "negative route unsubscribed");
+    check(plannerAddCar(planner, TEST_STATION, TEST_CAR), "car not added");
+    check(plannerGetPath(planner, TEST_STATION, TEST_STATION, path, TEST_PATH_SIZE) == 1 && path[0] == TEST_STATION, "station lost");
+    check(plannerQueuePath(planner, TEST_STATION, TEST_STATION), "path not queued");
+    plannerAnswerPaths(planner);
+    check(replies.count == 2 && replies.length == 1 && replies.first == TEST_STATION, "queued path lost");
+    check(plannerDelStation(planner, TEST_STATION), "station not demolished");
+    plannerFree(planner);
+}